@@ -0,0 +1,210 @@
+#include "allreduce.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+RingAllReduce::RingAllReduce(int rank, int worldSize, const char* host,
+                             int basePort)
+{
+    m_rank = rank;
+    m_worldSize = worldSize;
+    strncpy(m_host, host, sizeof(m_host)-1);
+    m_host[sizeof(m_host)-1] = 0;
+    m_basePort = basePort;
+
+    m_listenFd = -1;
+    m_nextFd = -1;
+    m_prevFd = -1;
+
+    m_recvBuffer = nullptr;
+    m_recvBufferSize = 0;
+}
+
+RingAllReduce::~RingAllReduce()
+{
+    if(m_listenFd >= 0)
+        close(m_listenFd);
+    if(m_nextFd >= 0)
+        close(m_nextFd);
+    if(m_prevFd >= 0)
+        close(m_prevFd);
+
+    delete[] m_recvBuffer;
+}
+
+bool RingAllReduce::connect(int timeout)
+{
+    // a ring of one doesn't need any sockets
+    if(m_worldSize <= 1)
+        return true;
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    if(inet_pton(AF_INET, m_host, &address.sin_addr) != 1)
+        return false;
+
+    m_listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if(m_listenFd < 0)
+        return false;
+
+    int yes = 1;
+    setsockopt(m_listenFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    address.sin_port = htons((uint16_t)(m_basePort + m_rank));
+    if(bind(m_listenFd, (sockaddr*)&address, sizeof(address)) < 0
+       || listen(m_listenFd, 1) < 0)
+        return false;
+
+    // keep trying to connect to the next process until it's listening
+    int next = (m_rank + 1) % m_worldSize;
+    address.sin_port = htons((uint16_t)(m_basePort + next));
+
+    auto deadline = std::chrono::steady_clock::now()
+                    + std::chrono::milliseconds(timeout);
+    while(true)
+    {
+        m_nextFd = socket(AF_INET, SOCK_STREAM, 0);
+        if(m_nextFd < 0)
+            return false;
+        if(::connect(m_nextFd, (sockaddr*)&address, sizeof(address)) == 0)
+            break;
+
+        close(m_nextFd);
+        m_nextFd = -1;
+        if(std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    // then wait for the previous process to connect to us
+    pollfd p;
+    p.fd = m_listenFd;
+    p.events = POLLIN;
+    if(poll(&p, 1, timeout) <= 0)
+        return false;
+    m_prevFd = accept(m_listenFd, nullptr, nullptr);
+    if(m_prevFd < 0)
+        return false;
+
+    // lots of small messages go back and forth, don't let them wait, and
+    //  make both sockets non-blocking so exchange can do both at once
+    setsockopt(m_nextFd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    setsockopt(m_prevFd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    fcntl(m_nextFd, F_SETFL, fcntl(m_nextFd, F_GETFL) | O_NONBLOCK);
+    fcntl(m_prevFd, F_SETFL, fcntl(m_prevFd, F_GETFL) | O_NONBLOCK);
+
+    return true;
+}
+
+bool RingAllReduce::exchange(char const* sendData, int sendSize,
+                             char* recvData, int recvSize)
+{
+    while(sendSize > 0 || recvSize > 0)
+    {
+        pollfd p[2];
+        p[0].fd = m_nextFd;
+        p[0].events = sendSize > 0 ? POLLOUT : 0;
+        p[0].revents = 0;
+        p[1].fd = m_prevFd;
+        p[1].events = recvSize > 0 ? POLLIN : 0;
+        p[1].revents = 0;
+
+        if(poll(p, 2, -1) < 0)
+            return false;
+
+        if(sendSize > 0 && (p[0].revents & (POLLERR | POLLHUP)))
+            return false;
+        if(sendSize > 0 && (p[0].revents & POLLOUT))
+        {
+            ssize_t sent = send(m_nextFd, sendData, sendSize, MSG_NOSIGNAL);
+            if(sent < 0)
+                return false;
+            sendData += sent;
+            sendSize -= (int)sent;
+        }
+
+        if(recvSize > 0 && (p[1].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            ssize_t got = recv(m_prevFd, recvData, recvSize, 0);
+            if(got <= 0)
+                return false;
+            recvData += got;
+            recvSize -= (int)got;
+        }
+    }
+    return true;
+}
+
+bool RingAllReduce::allReduce(float* data, int count)
+{
+    int n = m_worldSize;
+    if(n <= 1 || count <= 0)
+        return true;
+
+    // split the array into one chunk per process, the last chunk takes
+    //  whatever is left over
+    int chunkSize = (count + n - 1) / n;
+    auto chunkStart = [chunkSize, count](int chunk)
+    {
+        int start = chunk * chunkSize;
+        return start < count ? start : count;
+    };
+    auto chunkCount = [chunkSize, count, &chunkStart](int chunk)
+    {
+        int end = chunkStart(chunk) + chunkSize;
+        if(end > count)
+            end = count;
+        return end - chunkStart(chunk);
+    };
+
+    if(m_recvBufferSize < chunkSize)
+    {
+        delete[] m_recvBuffer;
+        m_recvBuffer = new float[chunkSize];
+        m_recvBufferSize = chunkSize;
+    }
+
+    // reduce-scatter: after n-1 steps each process has the full sum of
+    //  one chunk
+    for(int step = 0; step < n-1; ++step)
+    {
+        int sendChunk = ((m_rank - step) % n + n) % n;
+        int recvChunk = ((m_rank - step - 1) % n + n) % n;
+
+        int recvCount = chunkCount(recvChunk);
+        if(!exchange((char*)(data + chunkStart(sendChunk)),
+                     chunkCount(sendChunk)*4,
+                     (char*)m_recvBuffer, recvCount*4))
+            return false;
+
+        float* dest = data + chunkStart(recvChunk);
+        for(int i = 0; i < recvCount; ++i)
+            dest[i] += m_recvBuffer[i];
+    }
+
+    // all-gather: pass the finished chunks around the ring
+    for(int step = 0; step < n-1; ++step)
+    {
+        int sendChunk = ((m_rank - step + 1) % n + n) % n;
+        int recvChunk = ((m_rank - step) % n + n) % n;
+
+        if(!exchange((char*)(data + chunkStart(sendChunk)),
+                     chunkCount(sendChunk)*4,
+                     (char*)(data + chunkStart(recvChunk)),
+                     chunkCount(recvChunk)*4))
+            return false;
+    }
+
+    return true;
+}
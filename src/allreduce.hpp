@@ -0,0 +1,66 @@
+#pragma once
+
+/***
+ * @brief Sums arrays of floats across several processes, each connected to
+ *          the next one in a ring over TCP
+ *          Rank r listens on basePort+r and connects to rank r+1, so every
+ *          process only ever talks to its two neighbours and each sends
+ *          about 2*(n-1)/n of the array no matter how many processes there
+ *          are
+ */
+class RingAllReduce
+{
+public:
+    /***
+     * @param rank Index of this process in the ring, 0 to worldSize-1
+     * @param worldSize Number of processes in the ring
+     * @param host Address every process listens on, usually "127.0.0.1"
+     * @param basePort Port of rank 0, the other ranks use the ports after it
+     */
+    RingAllReduce(int rank, int worldSize, const char* host, int basePort);
+    ~RingAllReduce();
+
+    RingAllReduce(RingAllReduce const&) = delete;
+    RingAllReduce& operator=(RingAllReduce const&) = delete;
+
+    /***
+     * @brief Connects to the neighbouring processes, retrying for a while
+     *          since they might not have started listening yet
+     * @param timeout How long to keep trying, in milliseconds
+     * @return Whether or not the ring was connected
+     */
+    bool connect(int timeout);
+
+    /***
+     * @brief Replaces data with the sum of data across every process
+     *          Every process must call this with the same count, in the
+     *          same order
+     * @param data Array to sum in place
+     * @param count Number of floats in the array
+     * @return Whether or not it worked, false means the ring is broken
+     */
+    bool allReduce(float* data, int count);
+
+    int getRank() { return m_rank; }
+    int getWorldSize() { return m_worldSize; }
+
+private:
+    // sends to the next process while receiving from the previous one, at
+    //  the same time so neither side blocks on a full socket buffer
+    bool exchange(char const* sendData, int sendSize,
+                  char* recvData, int recvSize);
+
+    int m_rank;
+    int m_worldSize;
+    char m_host[64];
+    int m_basePort;
+
+    int m_listenFd;
+    // socket to the next and previous process in the ring
+    int m_nextFd;
+    int m_prevFd;
+
+    // where chunks from the previous process are received before adding
+    float* m_recvBuffer;
+    int m_recvBufferSize;
+};
@@ -0,0 +1,73 @@
+#include "async.hpp"
+
+#include <thread>
+#include <utility>
+
+#include "nn.hpp"
+
+static int defaultWorkers(int workers)
+{
+    if(workers > 0)
+        return workers;
+    workers = (int)std::thread::hardware_concurrency();
+    return workers > 0 ? workers : 1;
+}
+
+AsyncNetwork::AsyncNetwork(NeuralNetwork* network, int maxBatch, int maxWait,
+                           int workers)
+        : m_batcher(network, maxBatch, maxWait, defaultWorkers(workers))
+{
+    m_inputCount = network->getInputCount();
+    m_outputCount = network->getOutputCount();
+}
+
+std::future<std::vector<float>> AsyncNetwork::guess(float const* input)
+{
+    auto request = new FutureRequest;
+    request->outputCount = m_outputCount;
+    std::future<std::vector<float>> result = request->promise.get_future();
+
+    m_batcher.submit(input, &AsyncNetwork::onFutureDone, request);
+    return result;
+}
+
+void AsyncNetwork::guess(float const* input,
+                         std::function<void(float const*)> done)
+{
+    auto request = new CallbackRequest;
+    request->done = std::move(done);
+
+    m_batcher.submit(input, &AsyncNetwork::onCallbackDone, request);
+}
+
+void AsyncNetwork::onFutureDone(float const* output, void* userData)
+{
+    auto request = (FutureRequest*)userData;
+    request->promise.set_value(
+        std::vector<float>(output, output + request->outputCount));
+    delete request;
+}
+
+void AsyncNetwork::onCallbackDone(float const* output, void* userData)
+{
+    auto request = (CallbackRequest*)userData;
+    request->done(output);
+    delete request;
+}
+
+#if defined(__cpp_impl_coroutine)
+void GuessAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+    m_handle = handle;
+    // the coroutine can be resumed (and this destroyed along with it) as
+    //  soon as it's submitted, so nothing can come after this
+    m_batcher->submit(m_input, &GuessAwaitable::onDone, this);
+}
+
+void GuessAwaitable::onDone(float const* output, void* userData)
+{
+    auto awaitable = (GuessAwaitable*)userData;
+    awaitable->m_output.assign(output, output + awaitable->m_outputCount);
+    awaitable->m_handle.resume();
+}
+#endif
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <functional>
+#include <future>
+#include <vector>
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
+
+#include "batcher.hpp"
+
+class NeuralNetwork;
+
+#if defined(__cpp_impl_coroutine)
+/***
+ * @brief What AsyncNetwork::guessAsync gives back, co_await it to get the
+ *          outputs, only there when compiling as C++20
+ *          The coroutine carries on from a Batcher worker thread, so it
+ *          should hand anything slow back to its own executor
+ */
+class GuessAwaitable
+{
+public:
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> handle);
+    std::vector<float> await_resume() { return std::move(m_output); }
+
+private:
+    friend class AsyncNetwork;
+
+    GuessAwaitable(Batcher* batcher, float const* input, int outputCount)
+    {
+        m_batcher = batcher;
+        m_input = input;
+        m_outputCount = outputCount;
+    }
+
+    static void onDone(float const* output, void* userData);
+
+    Batcher* m_batcher;
+    float const* m_input;
+    int m_outputCount;
+    std::vector<float> m_output;
+    std::coroutine_handle<> m_handle;
+};
+#endif
+
+/***
+ * @brief Guesses without blocking the calling thread, for event loops that
+ *          can't sit in NeuralNetwork::guess
+ *          Requests are run by its own Batcher, so ones that arrive close
+ *          together go through the network as one guessBatch. Results come
+ *          back as a future, a callback or (with C++20) something to
+ *          co_await
+ *          Batcher::submit through getBatcher is the same thing without
+ *          allocating anything
+ *          The network must not be trained while this is using it
+ */
+class AsyncNetwork
+{
+public:
+    /***
+     * @param network Network to guess with
+     * @param maxBatch Most requests to put in one batch
+     * @param maxWait Longest a request waits for its batch to fill up,
+     *          in microseconds
+     * @param workers Number of threads running batches, 0 for one on
+     *          each core
+     */
+    AsyncNetwork(NeuralNetwork* network, int maxBatch = 32,
+                 int maxWait = 200, int workers = 0);
+    /***
+     * @brief Runs whatever is still queued then stops the workers
+     */
+    ~AsyncNetwork() {}
+
+    AsyncNetwork(AsyncNetwork const&) = delete;
+    AsyncNetwork& operator=(AsyncNetwork const&) = delete;
+
+    /***
+     * @brief Queues a guess
+     * @param input getInputCount() floats, copied before this returns
+     * @return The outputs, once the guess's batch has been run
+     */
+    std::future<std::vector<float>> guess(float const* input);
+    /***
+     * @brief Queues a guess and calls a function with the outputs
+     * @param input getInputCount() floats, copied before this returns
+     * @param done Called from a worker thread with getOutputCount() floats,
+     *          which only last until it returns
+     */
+    void guess(float const* input, std::function<void(float const*)> done);
+
+#if defined(__cpp_impl_coroutine)
+    /***
+     * @brief Queues a guess when the result is co_awaited
+     * @param input getInputCount() floats, copied when it's co_awaited so
+     *          it has to last until then
+     */
+    GuessAwaitable guessAsync(float const* input)
+    {
+        return GuessAwaitable(&m_batcher, input, m_outputCount);
+    }
+#endif
+
+    int getInputCount() { return m_inputCount; }
+    int getOutputCount() { return m_outputCount; }
+    Batcher& getBatcher() { return m_batcher; }
+
+private:
+    struct FutureRequest
+    {
+        std::promise<std::vector<float>> promise;
+        int outputCount;
+    };
+    struct CallbackRequest
+    {
+        std::function<void(float const*)> done;
+    };
+
+    static void onFutureDone(float const* output, void* userData);
+    static void onCallbackDone(float const* output, void* userData);
+
+    int m_inputCount;
+    int m_outputCount;
+
+    Batcher m_batcher;
+};
@@ -0,0 +1,183 @@
+#include "batcher.hpp"
+
+#include <cstring>
+
+#include "nn.hpp"
+#include "numa.hpp"
+
+Batcher::Batcher(NeuralNetwork* network, int maxBatch, int maxWait,
+                 int workers, int const* cpus)
+        : m_maxWait(maxWait)
+{
+    m_network = network;
+    m_inputCount = network->getInputCount();
+    m_outputCount = network->getOutputCount();
+
+    m_maxBatch = maxBatch < 1 ? 1 : maxBatch;
+
+    m_stopping = false;
+    m_batches = 0;
+    m_requests = 0;
+
+    if(workers < 1)
+        workers = 1;
+
+    // room for every worker to have a full batch waiting, so it only grows
+    //  if requests come in faster than batches are run
+    m_queue.resize(m_maxBatch * (workers+1));
+    m_queueInputs.resize(m_queue.size() * m_inputCount);
+    m_queueStart = 0;
+    m_queueSize = 0;
+
+    for(int i = 0; i < workers; ++i)
+        m_workers.emplace_back(&Batcher::workerLoop, this,
+                               cpus ? cpus[i] : -1);
+}
+
+Batcher::~Batcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+
+    for(auto& worker : m_workers)
+        worker.join();
+}
+
+void Batcher::submit(float const* input, BatchCallback callback,
+                     void* userData)
+{
+    std::chrono::steady_clock::time_point arrived =
+        std::chrono::steady_clock::now();
+
+    bool full;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_queueSize == (int)m_queue.size())
+            growQueue();
+
+        int slot = (m_queueStart + m_queueSize) % (int)m_queue.size();
+        Request& request = m_queue[slot];
+        request.callback = callback;
+        request.userData = userData;
+        request.arrived = arrived;
+        memcpy(&m_queueInputs[(size_t)slot * m_inputCount], input,
+               m_inputCount * sizeof(float));
+
+        m_queueSize++;
+        full = m_queueSize >= m_maxBatch;
+    }
+
+    // a worker only needs to wake up early for the first request (to start
+    //  its timer) or once there's a full batch waiting
+    if(full)
+        m_wake.notify_all();
+    else
+        m_wake.notify_one();
+}
+
+void Batcher::growQueue()
+{
+    int size = (int)m_queue.size();
+    std::vector<Request> queue(size * 2);
+    std::vector<float> inputs(queue.size() * m_inputCount);
+
+    // unwrap the ring so it starts at the beginning again
+    for(int i = 0; i < m_queueSize; ++i)
+    {
+        int slot = (m_queueStart + i) % size;
+        queue[i] = m_queue[slot];
+        memcpy(&inputs[(size_t)i * m_inputCount],
+               &m_queueInputs[(size_t)slot * m_inputCount],
+               m_inputCount * sizeof(float));
+    }
+
+    m_queue.swap(queue);
+    m_queueInputs.swap(inputs);
+    m_queueStart = 0;
+}
+
+long long Batcher::getBatchCount()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_batches;
+}
+
+long long Batcher::getRequestCount()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_requests;
+}
+
+void Batcher::workerLoop(int cpu)
+{
+    if(cpu >= 0)
+        pinThreadToCpu(cpu);
+
+    std::vector<Request> batch;
+    std::vector<float> inputs;
+    std::vector<float> outputs;
+    // under load every batch is full, so they stop allocating once the
+    //  workspace has matrices that size
+    GuessWorkspace workspace;
+
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            m_wake.wait(lock, [this]
+            {
+                return m_stopping || m_queueSize > 0;
+            });
+            if(m_queueSize == 0)
+                return;
+
+            // wait until the batch fills up or the oldest request runs out
+            //  of time, another worker might take the queue in the meantime
+            while(!m_stopping && m_queueSize > 0
+                  && m_queueSize < m_maxBatch)
+            {
+                auto deadline = m_queue[m_queueStart].arrived + m_maxWait;
+                if(m_wake.wait_until(lock, deadline)
+                   == std::cv_status::timeout)
+                    break;
+            }
+            if(m_queueSize == 0)
+                continue;
+
+            int count = m_queueSize;
+            if(count > m_maxBatch)
+                count = m_maxBatch;
+
+            // the inputs have to be copied out before the lock is let go,
+            //  submit can reuse their slots straight away
+            batch.clear();
+            inputs.resize(count * m_inputCount);
+            for(int i = 0; i < count; ++i)
+            {
+                batch.push_back(m_queue[m_queueStart]);
+                memcpy(&inputs[(size_t)i * m_inputCount],
+                       &m_queueInputs[(size_t)m_queueStart * m_inputCount],
+                       m_inputCount * sizeof(float));
+                m_queueStart = (m_queueStart+1) % (int)m_queue.size();
+            }
+            m_queueSize -= count;
+
+            m_batches++;
+            m_requests += count;
+        }
+
+        int count = (int)batch.size();
+        outputs.resize(count * m_outputCount);
+
+        m_network->guessBatch(inputs.data(), outputs.data(), count,
+                              workspace);
+
+        for(int i = 0; i < count; ++i)
+            batch[i].callback(outputs.data() + i*m_outputCount,
+                              batch[i].userData);
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class NeuralNetwork;
+
+// called with the outputs of a request once its batch has been run
+typedef void(*BatchCallback)(float const* output, void* userData);
+
+/***
+ * @brief Gathers single guesses submitted from any thread into batches and
+ *          runs them with NeuralNetwork::guessBatch on a pool of workers
+ *          A batch is run once it's full or the oldest request in it has
+ *          waited long enough, whichever comes first
+ *          The network must not be trained while the batcher is using it
+ */
+class Batcher
+{
+public:
+    /***
+     * @param network Network to guess with
+     * @param maxBatch Most requests to put in one batch
+     * @param maxWait Longest a request waits for its batch to fill up,
+     *          in microseconds
+     * @param workers Number of threads running batches
+     * @param cpus CPU to pin each worker to, or nullptr to let them move
+     */
+    Batcher(NeuralNetwork* network, int maxBatch, int maxWait, int workers,
+            int const* cpus = nullptr);
+    /***
+     * @brief Runs whatever is still queued then stops the workers
+     */
+    ~Batcher();
+
+    Batcher(Batcher const&) = delete;
+    Batcher& operator=(Batcher const&) = delete;
+
+    /***
+     * @brief Queues a guess, the callback is called from a worker thread
+     *          once it's done
+     *          Doesn't allocate anything unless more requests are waiting
+     *          than ever have been before
+     * @param input The network's number of inputs worth of floats, copied
+     *          so it doesn't have to stay around
+     * @param callback Function to call with the outputs
+     * @param userData Passed to the callback as is
+     */
+    void submit(float const* input, BatchCallback callback, void* userData);
+
+    /***
+     * @return Number of batches that have been run
+     */
+    long long getBatchCount();
+    /***
+     * @return Number of requests that have been run
+     */
+    long long getRequestCount();
+
+private:
+    struct Request
+    {
+        BatchCallback callback;
+        void* userData;
+        std::chrono::steady_clock::time_point arrived;
+    };
+
+    void workerLoop(int cpu);
+    // doubles the size of the queue, the lock has to be held
+    void growQueue();
+
+    NeuralNetwork* m_network;
+    int m_inputCount;
+    int m_outputCount;
+
+    int m_maxBatch;
+    std::chrono::microseconds m_maxWait;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    // ring of waiting requests, with their inputs one after another in
+    //  m_queueInputs, only grows when it's full so submit doesn't allocate
+    std::vector<Request> m_queue;
+    std::vector<float> m_queueInputs;
+    int m_queueStart;
+    int m_queueSize;
+    bool m_stopping;
+
+    long long m_batches;
+    long long m_requests;
+
+    std::vector<std::thread> m_workers;
+};
@@ -0,0 +1,475 @@
+#include "checkpoint.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+
+#include "conv.hpp"
+#include "gmath.h"
+#include "matrix.hpp"
+#include "nn.hpp"
+#include "normalizer.hpp"
+
+Checkpointer::Checkpointer(NeuralNetwork* network, int blockSize)
+{
+    m_network = network;
+    m_blockSize = blockSize > 0 ? blockSize : CHECKPOINT_BLOCK_SIZE;
+
+    m_busy = false;
+    m_stop = false;
+    m_failed = false;
+    m_job.full = false;
+    m_snapshot = nullptr;
+    m_referenceHash = 0;
+    m_hasReference = false;
+
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    m_thread = std::thread(&Checkpointer::run, this);
+}
+
+Checkpointer::~Checkpointer()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        waitIdle(lock);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+
+    delete m_snapshot;
+}
+
+void Checkpointer::save(const char* filename)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    waitIdle(lock);
+
+    // the background thread is idle so the snapshot is ours to change
+    takeSnapshot();
+    m_job.filename = filename;
+    m_job.full = true;
+    m_busy = true;
+
+    std::chrono::duration<double> taken =
+        std::chrono::steady_clock::now() - start;
+    m_stats.stallSeconds += taken.count();
+
+    lock.unlock();
+    m_wake.notify_all();
+}
+
+bool Checkpointer::saveDelta(const char* filename)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    waitIdle(lock);
+
+    // the background thread is idle so the buffers are ours to fill, the
+    //  reference is only swapped with them once the delta is written
+    gather(m_network, m_pending, m_pendingShape);
+    bool ok = m_hasReference && m_pendingShape == m_referenceShape;
+    if(ok)
+    {
+        m_job.filename = filename;
+        m_job.full = false;
+        m_busy = true;
+    }
+
+    std::chrono::duration<double> taken =
+        std::chrono::steady_clock::now() - start;
+    m_stats.stallSeconds += taken.count();
+
+    lock.unlock();
+    if(ok)
+        m_wake.notify_all();
+    return ok;
+}
+
+bool Checkpointer::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    waitIdle(lock);
+
+    bool ok = !m_failed;
+    m_failed = false;
+    return ok;
+}
+
+bool Checkpointer::isBusy()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_busy;
+}
+
+CheckpointStats Checkpointer::getStats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void Checkpointer::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(true)
+    {
+        m_wake.wait(lock, [this] { return m_busy || m_stop; });
+        if(!m_busy)
+            return;
+
+        // the job and buffers aren't touched by anyone else while busy, so
+        //  the lock doesn't need holding while writing
+        lock.unlock();
+        auto start = std::chrono::steady_clock::now();
+
+        bool full = m_job.full;
+        if(full)
+            writeFull(m_job);
+        else
+            writeDelta(m_job);
+
+        std::chrono::duration<double> taken =
+            std::chrono::steady_clock::now() - start;
+        lock.lock();
+
+        m_stats.writeSeconds += taken.count();
+        if(full)
+            m_stats.fullSaves++;
+        else
+            m_stats.deltaSaves++;
+        m_busy = false;
+        m_wake.notify_all();
+    }
+}
+
+void Checkpointer::writeFull(Job& job)
+{
+    if(m_snapshot->save(job.filename.c_str()))
+    {
+        gather(m_snapshot, m_reference, m_referenceShape);
+        m_referenceHash = hashWords(m_reference.data(), m_reference.size());
+        m_hasReference = true;
+
+        std::ifstream file(job.filename, std::ios::binary | std::ios::ate);
+        long long bytes = file ? (long long)file.tellg() : 0;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stats.bytesWritten += bytes;
+    }
+    else
+    {
+        // deltas carry on from the last checkpoint that was written
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_failed = true;
+    }
+}
+
+bool Checkpointer::writeDelta(Job& job)
+{
+    /*
+     * Format of file:
+     *
+     * 8 bytes - identifying the file
+     *
+     * 8 bytes - hash of the values this delta goes on top of
+     * 8 bytes - hash of the values once it's applied
+     * 8 bytes - number of values (weights then biases of each dense layer,
+     *  then the weights and biases of each convolution)
+     * 4 bytes - number of floats in each block
+     * 4 bytes - number of blocks in the file
+     *
+     * then for each block:
+     * 4 bytes - index of the block
+     * however many bytes - its values, the last block can be short
+     */
+    long long size = (long long)m_pending.size();
+    long long blocks = (size + m_blockSize - 1) / m_blockSize;
+
+    std::vector<int> changed;
+    for(long long b = 0; b < blocks; ++b)
+    {
+        long long first = b * m_blockSize;
+        long long count = size - first < m_blockSize ? size - first
+                                                     : m_blockSize;
+        // compare the bits, so a value going from 0 to -0 is still written
+        if(memcmp(m_pending.data() + first, m_reference.data() + first,
+                  count * sizeof(float)) != 0)
+            changed.push_back((int)b);
+    }
+
+    uint64_t hash = hashWords(m_pending.data(), m_pending.size());
+    int blockSize = m_blockSize;
+    int changedCount = (int)changed.size();
+
+    std::fstream file;
+    file.open(job.filename, std::ios::out | std::ios::binary);
+
+    char fileId[] = CHECKPOINT_DELTA_ID;
+    file.write(fileId, sizeof(fileId));
+    file.write((char*)&m_referenceHash, 8);
+    file.write((char*)&hash, 8);
+    file.write((char*)&size, 8);
+    file.write((char*)&blockSize, 4);
+    file.write((char*)&changedCount, 4);
+
+    for(int b : changed)
+    {
+        long long first = (long long)b * m_blockSize;
+        long long count = size - first < m_blockSize ? size - first
+                                                     : m_blockSize;
+        file.write((char*)&b, 4);
+        file.write((char*)(m_pending.data() + first), count * sizeof(float));
+    }
+
+    long long bytes = file.is_open() ? (long long)file.tellp() : 0;
+    file.close();
+    bool ok = !file.fail();
+
+    if(ok)
+    {
+        m_reference.swap(m_pending);
+        m_referenceHash = hash;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(ok)
+    {
+        m_stats.bytesWritten += bytes;
+        m_stats.changedBlocks += changedCount;
+        m_stats.totalBlocks += blocks;
+    }
+    else
+    {
+        m_failed = true;
+    }
+    return ok;
+}
+
+void Checkpointer::waitIdle(std::unique_lock<std::mutex>& lock)
+{
+    m_wake.wait(lock, [this] { return !m_busy; });
+}
+
+void Checkpointer::takeSnapshot()
+{
+    if(!m_snapshot || !sameLayout(m_network, m_snapshot))
+    {
+        // making a network fills it with random weights first, so this is
+        //  the slow path
+        delete m_snapshot;
+        m_snapshot = m_network->copy();
+        return;
+    }
+
+    m_snapshot->setLearningRate(m_network->getLearningRate());
+    m_snapshot->setCheckpointInterval(m_network->getCheckpointInterval());
+    if(m_snapshot->getLoss() != m_network->getLoss())
+        m_snapshot->setLoss(m_network->getLoss());
+
+    // the normalizer is folded into the weights, so it's sorted out before
+    //  the weights are copied over whatever folding did
+    Normalizer const* normalizer = m_network->getNormalizer();
+    if(!normalizer)
+        m_snapshot->clearNormalizer();
+    else if(!sameNormalizer(normalizer, m_snapshot->getNormalizer()))
+        m_snapshot->setNormalizer(*normalizer);
+
+    // same sizes, so each assignment is a memcpy into the storage the
+    //  snapshot already has
+    std::vector<Matrix*> from;
+    std::vector<Matrix*> to;
+    getMatrices(m_network, from);
+    getMatrices(m_snapshot, to);
+    for(size_t i = 0; i < from.size(); ++i)
+        *to[i] = *from[i];
+
+    m_snapshot->markWeightsChanged();
+}
+
+bool Checkpointer::sameLayout(NeuralNetwork* a, NeuralNetwork* b)
+{
+    if(a->getLayerCount() != b->getLayerCount()
+       || a->getFeatureLayerCount() != b->getFeatureLayerCount())
+        return false;
+
+    for(int i = 0; i < a->getFeatureLayerCount(); ++i)
+    {
+        FeatureLayer* first = a->getFeatureLayer(i);
+        FeatureLayer* second = b->getFeatureLayer(i);
+        if(first->getType() != second->getType()
+           || first->getInputSize() != second->getInputSize()
+           || first->getOutputSize() != second->getOutputSize())
+            return false;
+    }
+
+    std::vector<Matrix*> first;
+    std::vector<Matrix*> second;
+    getMatrices(a, first);
+    getMatrices(b, second);
+    if(first.size() != second.size())
+        return false;
+    for(size_t i = 0; i < first.size(); ++i)
+    {
+        if(first[i]->getRows() != second[i]->getRows()
+           || first[i]->getColumns() != second[i]->getColumns())
+            return false;
+    }
+    return true;
+}
+
+bool Checkpointer::sameNormalizer(Normalizer const* a, Normalizer const* b)
+{
+    if(!a || !b)
+        return a == b;
+    if(a->getMode() != b->getMode()
+       || a->getFeatureCount() != b->getFeatureCount())
+        return false;
+
+    for(int f = 0; f < a->getFeatureCount(); ++f)
+    {
+        if(a->getScale(f) != b->getScale(f) || a->getShift(f) != b->getShift(f))
+            return false;
+    }
+    return true;
+}
+
+NeuralNetwork* Checkpointer::restore(const char* filename,
+                                     const char* const* deltas, int count)
+{
+    NeuralNetwork* network = NeuralNetwork::load(filename);
+    if(!network || count <= 0)
+        return network;
+
+    std::vector<float> values;
+    std::vector<long long> shape;
+    gather(network, values, shape);
+    uint64_t hash = hashWords(values.data(), values.size());
+
+    for(int d = 0; d < count; ++d)
+    {
+        std::fstream file;
+        file.open(deltas[d], std::ios::in | std::ios::binary);
+
+        char fileId[] = CHECKPOINT_DELTA_ID;
+        char readId[sizeof(fileId)];
+        uint64_t baseHash;
+        uint64_t resultHash;
+        long long size;
+        int blockSize;
+        int changedCount;
+
+        file.read(readId, sizeof(readId));
+        file.read((char*)&baseHash, 8);
+        file.read((char*)&resultHash, 8);
+        file.read((char*)&size, 8);
+        file.read((char*)&blockSize, 4);
+        file.read((char*)&changedCount, 4);
+
+        // it has to have been made against exactly what we have so far
+        if(!file || memcmp(readId, fileId, sizeof(fileId)) != 0
+           || baseHash != hash || size != (long long)values.size()
+           || blockSize <= 0 || changedCount < 0)
+        {
+            delete network;
+            return nullptr;
+        }
+
+        long long blocks = (size + blockSize - 1) / blockSize;
+        for(int i = 0; i < changedCount; ++i)
+        {
+            int b = -1;
+            file.read((char*)&b, 4);
+            if(!file || b < 0 || b >= blocks)
+            {
+                delete network;
+                return nullptr;
+            }
+
+            long long first = (long long)b * blockSize;
+            long long length = size - first < blockSize ? size - first
+                                                        : blockSize;
+            file.read((char*)(values.data() + first), length * sizeof(float));
+        }
+
+        hash = hashWords(values.data(), values.size());
+        if(!file || hash != resultHash)
+        {
+            delete network;
+            return nullptr;
+        }
+    }
+
+    scatter(network, values);
+    network->markWeightsChanged();
+    return network;
+}
+
+void Checkpointer::getMatrices(NeuralNetwork* network,
+                               std::vector<Matrix*>& matrices)
+{
+    matrices.clear();
+
+    int layers = network->getLayerCount();
+    for(int i = 0; i < layers; ++i)
+        matrices.push_back(network->getWeights(i));
+    for(int i = 0; i < layers; ++i)
+        matrices.push_back(network->getBiases(i));
+
+    // pooling layers don't have anything to learn
+    for(int i = 0; i < network->getFeatureLayerCount(); ++i)
+    {
+        FeatureLayer* layer = network->getFeatureLayer(i);
+        if(layer->getType() != LAYER_CONV)
+            continue;
+
+        auto conv = (ConvLayer*)layer;
+        matrices.push_back(conv->getWeights());
+        matrices.push_back(conv->getBiases());
+    }
+}
+
+void Checkpointer::gather(NeuralNetwork* network, std::vector<float>& values,
+                          std::vector<long long>& shape)
+{
+    std::vector<Matrix*> matrices;
+    getMatrices(network, matrices);
+
+    shape.clear();
+    long long total = 0;
+    for(Matrix* m : matrices)
+    {
+        shape.push_back(m->getRows());
+        shape.push_back(m->getColumns());
+        total += (long long)m->getRows() * m->getColumns();
+    }
+
+    // every matrix's values are one block, so each is a single copy
+    values.resize(total);
+    float* at = values.data();
+    for(Matrix* m : matrices)
+    {
+        long long count = (long long)m->getRows() * m->getColumns();
+        if(count > 0)
+            memcpy(at, (*m)[0], count * sizeof(float));
+        at += count;
+    }
+}
+
+void Checkpointer::scatter(NeuralNetwork* network,
+                           std::vector<float> const& values)
+{
+    std::vector<Matrix*> matrices;
+    getMatrices(network, matrices);
+
+    float const* at = values.data();
+    for(Matrix* m : matrices)
+    {
+        long long count = (long long)m->getRows() * m->getColumns();
+        if(count > 0)
+            memcpy((*m)[0], at, count * sizeof(float));
+        at += count;
+    }
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CHECKPOINT_DELTA_ID { 'b', 'a', 'd', 'm', 'l', 'p', 'd', 'l' }
+// floats in each block that a delta keeps or leaves out as a whole
+#define CHECKPOINT_BLOCK_SIZE 1024
+
+class Matrix;
+class NeuralNetwork;
+class Normalizer;
+
+/***
+ * @brief Counters from a Checkpointer
+ */
+struct CheckpointStats
+{
+    long long fullSaves;
+    long long deltaSaves;
+    long long bytesWritten;
+    // blocks written by deltas, out of the blocks they could have written
+    long long changedBlocks;
+    long long totalBlocks;
+    // time the training thread spent in save/saveDelta, taking snapshots
+    //  or waiting for the previous checkpoint to finish
+    double stallSeconds;
+    // time the background thread spent writing
+    double writeSeconds;
+};
+
+/***
+ * @brief Saves checkpoints of a network on a background thread so training
+ *          can carry on while they're written
+ *          Each checkpoint copies the weights into a second buffer on the
+ *          calling thread first, which is only a memcpy for each matrix,
+ *          and the copy is written out while the network keeps changing.
+ *          Only one checkpoint is written at a time, starting another waits
+ *          for the previous one
+ *          After a full save, saveDelta writes only the blocks of weights
+ *          and biases that changed since the last checkpoint, which is much
+ *          smaller when most of the network is left alone (fine tuning the
+ *          last layers, sparse inputs). restore loads the full save and
+ *          replays the deltas in order
+ *          Deltas only hold the weights and biases (including convolution
+ *          kernels), anything else like the loss or learning rate comes from
+ *          the full save, and the network can't change shape in between
+ */
+class Checkpointer
+{
+public:
+    /***
+     * @param network Network to checkpoint, which has to outlive this
+     * @param blockSize Number of floats in each block of a delta, smaller
+     *          blocks skip more unchanged values but cost 4 bytes each
+     */
+    Checkpointer(NeuralNetwork* network, int blockSize = CHECKPOINT_BLOCK_SIZE);
+    /***
+     * @brief Waits for the checkpoint being written to finish
+     */
+    ~Checkpointer();
+
+    Checkpointer(Checkpointer const&) = delete;
+    Checkpointer& operator=(Checkpointer const&) = delete;
+
+    /***
+     * @brief Snapshots the network and writes it with NeuralNetwork::save
+     *          in the background, later deltas go on from this
+     * @param filename File to save to
+     */
+    void save(const char* filename);
+    /***
+     * @brief Snapshots the weights and biases and writes the blocks that
+     *          changed since the last checkpoint in the background
+     * @param filename File to save to
+     * @return False if there hasn't been a full save yet or the network
+     *          changed shape since, in which case nothing is written
+     */
+    bool saveDelta(const char* filename);
+
+    /***
+     * @brief Waits for the checkpoint being written to finish
+     * @return Whether every checkpoint since the last wait was written
+     *          successfully
+     */
+    bool wait();
+    /***
+     * @return Whether a checkpoint is still being written
+     */
+    bool isBusy();
+
+    /***
+     * @return The checkpointer's counters so far
+     */
+    CheckpointStats getStats();
+
+    /***
+     * @brief Loads a full save and replays deltas on top of it
+     * @param filename File written by save
+     * @param deltas Files written by saveDelta after it, in the order they
+     *          were written
+     * @param count Number of deltas
+     * @return The network as of the last delta, or nullptr if any of the
+     *          files couldn't be read or a delta doesn't follow on from the
+     *          one before it
+     */
+    static NeuralNetwork* restore(const char* filename,
+                                  const char* const* deltas, int count);
+
+private:
+    struct Job
+    {
+        std::string filename;
+        // a full save writes m_snapshot, a delta writes m_pending
+        bool full;
+    };
+
+    // runs jobs on the background thread until the checkpointer is deleted
+    void run();
+    void writeFull(Job& job);
+    bool writeDelta(Job& job);
+    // waits until no job is running, the lock has to be held
+    void waitIdle(std::unique_lock<std::mutex>& lock);
+    // copies the network into m_snapshot, only making a new one if the
+    //  network's layout changed
+    void takeSnapshot();
+    static bool sameLayout(NeuralNetwork* a, NeuralNetwork* b);
+    static bool sameNormalizer(Normalizer const* a, Normalizer const* b);
+
+    // every weight and bias matrix in the order deltas number them
+    static void getMatrices(NeuralNetwork* network,
+                            std::vector<Matrix*>& matrices);
+    // copies every matrix one after another into values, and their sizes
+    //  into shape
+    static void gather(NeuralNetwork* network, std::vector<float>& values,
+                       std::vector<long long>& shape);
+    // copies values back into the matrices
+    static void scatter(NeuralNetwork* network,
+                        std::vector<float> const& values);
+
+    NeuralNetwork* m_network;
+    int m_blockSize;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_busy;
+    bool m_stop;
+    bool m_failed;
+    Job m_job;
+    // copy of the network for full saves, kept between them so its
+    //  matrices don't have to be made again
+    NeuralNetwork* m_snapshot;
+
+    // values as of the last checkpoint written, which the next delta is
+    //  made against, and their hash
+    std::vector<float> m_reference;
+    std::vector<long long> m_referenceShape;
+    uint64_t m_referenceHash;
+    bool m_hasReference;
+    // snapshot of the values for the delta being written
+    std::vector<float> m_pending;
+    std::vector<long long> m_pendingShape;
+
+    CheckpointStats m_stats;
+};
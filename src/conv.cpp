@@ -0,0 +1,415 @@
+#include "conv.hpp"
+
+#include <climits>
+#include <initializer_list>
+
+#include "matrix.hpp"
+#include "nn.hpp"
+
+// reads/writes a whole matrix one float at a time, same as the dense layers
+static void saveMatrix(std::fstream& file, Matrix& m)
+{
+    for(int y = 0; y < m.getRows(); ++y)
+        for(int x = 0; x < m.getColumns(); ++x)
+            file.write((char*)&m[y][x], 4);
+}
+
+static void loadMatrix(std::fstream& file, Matrix& m)
+{
+    for(int y = 0; y < m.getRows(); ++y)
+        for(int x = 0; x < m.getColumns(); ++x)
+            file.read((char*)&m[y][x], 4);
+}
+
+// whether a count made of these sizes fits in an int
+static bool fits(long long a, long long b, long long c, long long d = 1)
+{
+    // multiplying up to 4 values that are each at most INT_MAX could
+    //  overflow a long long, so check as it goes
+    long long total = 1;
+    for(long long n : { a, b, c, d })
+    {
+        total *= n;
+        if(total > INT_MAX)
+            return false;
+    }
+    return true;
+}
+
+// shapes come from files, so anything that would make an empty or
+//  impossibly big layer means the file is broken
+static bool validConvShape(int const* shape)
+{
+    int channels = shape[0], height = shape[1], width = shape[2];
+    int filters = shape[3], kernel = shape[4], stride = shape[5];
+    int padding = shape[6];
+
+    if(channels < 1 || height < 1 || width < 1 || filters < 1
+       || kernel < 1 || stride < 1 || padding < 0)
+        return false;
+    // small enough that adding the padding to both sides can't overflow
+    if(padding > INT_MAX/4 - height || padding > INT_MAX/4 - width)
+        return false;
+    // the kernel has to fit inside the padded input at least once
+    if(kernel > height + 2*padding || kernel > width + 2*padding)
+        return false;
+
+    long long outHeight = (height + 2*padding - kernel) / stride + 1;
+    long long outWidth = (width + 2*padding - kernel) / stride + 1;
+    return fits(channels, height, width)
+           && fits(filters, channels, kernel, kernel)
+           && fits(filters, outHeight, outWidth)
+           && fits(channels, kernel, kernel, outHeight * outWidth);
+}
+
+static bool validPoolShape(int const* shape)
+{
+    int channels = shape[0], height = shape[1], width = shape[2];
+    int size = shape[3];
+
+    return channels > 0 && height > 0 && width > 0 && size > 0
+           && size <= height && size <= width
+           && fits(channels, height, width);
+}
+
+FeatureLayer* FeatureLayer::load(std::fstream& file)
+{
+    int type;
+    file.read((char*)&type, 4);
+
+    if(type == LAYER_CONV)
+    {
+        // channels, height, width, filters, kernel, stride, padding
+        int shape[7];
+        file.read((char*)shape, sizeof(shape));
+        if(!file || !validConvShape(shape))
+            return nullptr;
+
+        auto layer = new ConvLayer(shape[0], shape[1], shape[2], shape[3],
+                                   shape[4], shape[5], shape[6]);
+        loadMatrix(file, *layer->getWeights());
+        loadMatrix(file, *layer->getBiases());
+        if(!file)
+        {
+            delete layer;
+            return nullptr;
+        }
+        return layer;
+    }
+
+    if(type == LAYER_POOL_MAX || type == LAYER_POOL_AVG)
+    {
+        // channels, height, width, size
+        int shape[4];
+        file.read((char*)shape, sizeof(shape));
+        if(!file || !validPoolShape(shape))
+            return nullptr;
+
+        return new PoolLayer(shape[0], shape[1], shape[2], shape[3], type);
+    }
+
+    return nullptr;
+}
+
+ConvLayer::ConvLayer(int channels, int height, int width, int filters,
+                     int kernel, int stride, int padding)
+{
+    m_channels = channels;
+    m_height = height;
+    m_width = width;
+    m_filters = filters;
+    m_kernel = kernel;
+    m_stride = stride < 1 ? 1 : stride;
+    m_padding = padding;
+
+    m_outHeight = (height + 2*padding - kernel) / m_stride + 1;
+    m_outWidth = (width + 2*padding - kernel) / m_stride + 1;
+
+    // each filter's kernel is one row, covering every input channel
+    m_weights = new Matrix(filters, channels * kernel * kernel);
+    m_biases = new Matrix(filters, 1);
+    m_weights->randomize();
+    m_biases->randomize();
+}
+
+ConvLayer::~ConvLayer()
+{
+    delete m_weights;
+    delete m_biases;
+}
+
+long long ConvLayer::getFlops()
+{
+    long long positions = m_outHeight * m_outWidth;
+    long long patch = m_channels * m_kernel * m_kernel;
+    // the matrix product, then bias and activation
+    return m_filters * positions * (2*patch + 2);
+}
+
+Matrix ConvLayer::im2col(Matrix& input)
+{
+    int patch = m_channels * m_kernel * m_kernel;
+    Matrix cols(patch, m_outHeight * m_outWidth);
+
+    // row = which value of the patch, column = which patch
+    for(int c = 0; c < m_channels; ++c)
+    {
+        for(int ky = 0; ky < m_kernel; ++ky)
+        {
+            for(int kx = 0; kx < m_kernel; ++kx)
+            {
+                float* row = cols[(c*m_kernel + ky)*m_kernel + kx];
+
+                for(int oy = 0; oy < m_outHeight; ++oy)
+                {
+                    int y = oy*m_stride + ky - m_padding;
+                    for(int ox = 0; ox < m_outWidth; ++ox)
+                    {
+                        int x = ox*m_stride + kx - m_padding;
+
+                        // padding is left as the 0 the matrix starts with
+                        if(y >= 0 && y < m_height && x >= 0 && x < m_width)
+                            row[oy*m_outWidth + ox] =
+                                input[(c*m_height + y)*m_width + x][0];
+                    }
+                }
+            }
+        }
+    }
+
+    return cols;
+}
+
+Matrix ConvLayer::col2im(Matrix& cols)
+{
+    Matrix image(getInputSize(), 1);
+
+    for(int c = 0; c < m_channels; ++c)
+    {
+        for(int ky = 0; ky < m_kernel; ++ky)
+        {
+            for(int kx = 0; kx < m_kernel; ++kx)
+            {
+                float* row = cols[(c*m_kernel + ky)*m_kernel + kx];
+
+                for(int oy = 0; oy < m_outHeight; ++oy)
+                {
+                    int y = oy*m_stride + ky - m_padding;
+                    for(int ox = 0; ox < m_outWidth; ++ox)
+                    {
+                        int x = ox*m_stride + kx - m_padding;
+
+                        if(y >= 0 && y < m_height && x >= 0 && x < m_width)
+                            image[(c*m_height + y)*m_width + x][0] +=
+                                row[oy*m_outWidth + ox];
+                    }
+                }
+            }
+        }
+    }
+
+    return image;
+}
+
+Matrix ConvLayer::forward(Matrix& input)
+{
+    Matrix cols = im2col(input);
+
+    // one row per filter, one column per position in the output
+    Matrix result = m_weights->product(cols);
+    result.addToColumns(*m_biases);
+    result.map(&activtan);
+
+    // flatten into a column, one filter after another
+    int positions = m_outHeight * m_outWidth;
+    Matrix output(getOutputSize(), 1);
+    for(int f = 0; f < m_filters; ++f)
+        for(int p = 0; p < positions; ++p)
+            output[f*positions + p][0] = result[f][p];
+
+    return output;
+}
+
+Matrix ConvLayer::backward(Matrix& input, Matrix& output, Matrix& error,
+                           float learningRate)
+{
+    // put the output and error back into one row per filter
+    int positions = m_outHeight * m_outWidth;
+    Matrix gradient(m_filters, positions);
+    Matrix filterError(m_filters, positions);
+    for(int f = 0; f < m_filters; ++f)
+    {
+        for(int p = 0; p < positions; ++p)
+        {
+            gradient[f][p] = output[f*positions + p][0];
+            filterError[f][p] = error[f*positions + p][0];
+        }
+    }
+
+    // same as the dense layers, derivative times error times learning rate
+    gradient.map(&derivtan);
+    gradient *= filterError;
+    gradient *= learningRate;
+
+    // every position used the same bias
+    for(int f = 0; f < m_filters; ++f)
+    {
+        float sum = 0.0f;
+        for(int p = 0; p < positions; ++p)
+            sum += gradient[f][p];
+        (*m_biases)[f][0] += sum;
+    }
+
+    // and the same kernel, so the patches' changes are summed by the product
+    Matrix cols = im2col(input);
+    Matrix colsTrans = cols.transposed();
+    Matrix wDelta = gradient.product(colsTrans);
+    (*m_weights) += wDelta;
+
+    // pass the error back through the kernels and fold the patches back
+    //  into the shape of the input
+    Matrix weightTrans = m_weights->transposed();
+    Matrix colError = weightTrans.product(filterError);
+    return col2im(colError);
+}
+
+FeatureLayer* ConvLayer::copy()
+{
+    auto result = new ConvLayer(m_channels, m_height, m_width, m_filters,
+                                m_kernel, m_stride, m_padding);
+    *result->m_weights = *m_weights;
+    *result->m_biases = *m_biases;
+    return result;
+}
+
+void ConvLayer::save(std::fstream& file)
+{
+    int type = LAYER_CONV;
+    int shape[7] = { m_channels, m_height, m_width, m_filters, m_kernel,
+                     m_stride, m_padding };
+    file.write((char*)&type, 4);
+    file.write((char*)shape, sizeof(shape));
+
+    saveMatrix(file, *m_weights);
+    saveMatrix(file, *m_biases);
+}
+
+PoolLayer::PoolLayer(int channels, int height, int width, int size, int type)
+{
+    m_channels = channels;
+    m_height = height;
+    m_width = width;
+    m_size = size < 1 ? 1 : size;
+    m_type = type == LAYER_POOL_AVG ? LAYER_POOL_AVG : LAYER_POOL_MAX;
+
+    m_outHeight = height / m_size;
+    m_outWidth = width / m_size;
+}
+
+long long PoolLayer::getFlops()
+{
+    // one compare or add for each value in each window
+    return (long long)getOutputSize() * m_size * m_size;
+}
+
+Matrix PoolLayer::forward(Matrix& input)
+{
+    Matrix output(getOutputSize(), 1);
+
+    for(int c = 0; c < m_channels; ++c)
+    {
+        for(int oy = 0; oy < m_outHeight; ++oy)
+        {
+            for(int ox = 0; ox < m_outWidth; ++ox)
+            {
+                float best = input[(c*m_height + oy*m_size)*m_width
+                                   + ox*m_size][0];
+                float sum = 0.0f;
+
+                for(int ky = 0; ky < m_size; ++ky)
+                {
+                    for(int kx = 0; kx < m_size; ++kx)
+                    {
+                        int y = oy*m_size + ky;
+                        int x = ox*m_size + kx;
+                        float value = input[(c*m_height + y)*m_width + x][0];
+
+                        sum += value;
+                        if(value > best)
+                            best = value;
+                    }
+                }
+
+                float result = best;
+                if(m_type == LAYER_POOL_AVG)
+                    result = sum / (m_size * m_size);
+                output[(c*m_outHeight + oy)*m_outWidth + ox][0] = result;
+            }
+        }
+    }
+
+    return output;
+}
+
+Matrix PoolLayer::backward(Matrix& input, Matrix& output, Matrix& error,
+                           float learningRate)
+{
+    // nothing to learn, just route the error back to the inputs
+    (void)learningRate;
+
+    Matrix inputError(getInputSize(), 1);
+
+    for(int c = 0; c < m_channels; ++c)
+    {
+        for(int oy = 0; oy < m_outHeight; ++oy)
+        {
+            for(int ox = 0; ox < m_outWidth; ++ox)
+            {
+                int o = (c*m_outHeight + oy)*m_outWidth + ox;
+                float e = error[o][0];
+
+                if(m_type == LAYER_POOL_AVG)
+                {
+                    // every input had an equal share of the output
+                    float share = e / (m_size * m_size);
+                    for(int ky = 0; ky < m_size; ++ky)
+                        for(int kx = 0; kx < m_size; ++kx)
+                            inputError[(c*m_height + oy*m_size + ky)*m_width
+                                       + ox*m_size + kx][0] += share;
+                    continue;
+                }
+
+                // only the input that was the max had any effect, the first
+                //  one found if there were several
+                bool found = false;
+                for(int ky = 0; ky < m_size && !found; ++ky)
+                {
+                    for(int kx = 0; kx < m_size && !found; ++kx)
+                    {
+                        int i = (c*m_height + oy*m_size + ky)*m_width
+                                + ox*m_size + kx;
+                        if(input[i][0] == output[o][0])
+                        {
+                            inputError[i][0] += e;
+                            found = true;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return inputError;
+}
+
+FeatureLayer* PoolLayer::copy()
+{
+    return new PoolLayer(m_channels, m_height, m_width, m_size, m_type);
+}
+
+void PoolLayer::save(std::fstream& file)
+{
+    int shape[4] = { m_channels, m_height, m_width, m_size };
+    file.write((char*)&m_type, 4);
+    file.write((char*)shape, sizeof(shape));
+}
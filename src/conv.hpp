@@ -0,0 +1,178 @@
+#pragma once
+
+#include <fstream>
+
+class Matrix;
+
+// ids of each kind of feature layer, used in saved files
+#define LAYER_CONV 1
+#define LAYER_POOL_MAX 2
+#define LAYER_POOL_AVG 3
+
+/***
+ * @brief A layer that sits in front of the dense layers of a NeuralNetwork
+ *          and turns the raw inputs into features for them
+ *          Inputs and outputs are single column matrices, images are stored
+ *          one channel after another, each one row after another
+ */
+class FeatureLayer
+{
+public:
+    virtual ~FeatureLayer() {}
+
+    /***
+     * @return One of the LAYER_ ids
+     */
+    virtual int getType() = 0;
+    /***
+     * @return Number of values this layer takes in
+     */
+    virtual int getInputSize() = 0;
+    /***
+     * @return Number of values this layer gives out
+     */
+    virtual int getOutputSize() = 0;
+    /***
+     * @return Floating point operations done by one forward pass
+     */
+    virtual long long getFlops() = 0;
+
+    /***
+     * @brief Runs the layer
+     * @param input Column matrix of getInputSize() values
+     * @return Column matrix of getOutputSize() values
+     */
+    virtual Matrix forward(Matrix& input) = 0;
+    /***
+     * @brief Adjusts the layer from the error of its output, the same way
+     *          NeuralNetwork::propagate adjusts the dense layers
+     * @param input What was given to forward
+     * @param output What forward returned
+     * @param error Error of the output
+     * @param learningRate How much to scale the adjustments by
+     * @return Error of the input, to pass on to the layer before
+     */
+    virtual Matrix backward(Matrix& input, Matrix& output, Matrix& error,
+                            float learningRate) = 0;
+
+    /***
+     * @return A new layer exactly the same as this one
+     */
+    virtual FeatureLayer* copy() = 0;
+    /***
+     * @brief Writes the layer's shape and values, starting with its type
+     * @param file File to write to
+     */
+    virtual void save(std::fstream& file) = 0;
+    /***
+     * @brief Reads a layer written with save
+     * @param file File to read from
+     * @return The layer, or nullptr if it wasn't a known type, its shape
+     *          doesn't make sense or the file ends early
+     */
+    static FeatureLayer* load(std::fstream& file);
+};
+
+/***
+ * @brief 2D convolution followed by tanh
+ *          Every patch of the input is unrolled into a column (im2col) so
+ *          the whole convolution is one matrix product with the kernels
+ */
+class ConvLayer : public FeatureLayer
+{
+public:
+    /***
+     * @param channels Number of input channels
+     * @param height Input height
+     * @param width Input width
+     * @param filters Number of output channels
+     * @param kernel Width and height of each kernel
+     * @param stride How far the kernel moves each step
+     * @param padding Number of zeroes around the edges of the input
+     */
+    ConvLayer(int channels, int height, int width, int filters, int kernel,
+              int stride, int padding);
+    ~ConvLayer() override;
+
+    int getType() override { return LAYER_CONV; }
+    int getInputSize() override { return m_channels * m_height * m_width; }
+    int getOutputSize() override { return m_filters * m_outHeight * m_outWidth; }
+    long long getFlops() override;
+
+    int getOutputHeight() { return m_outHeight; }
+    int getOutputWidth() { return m_outWidth; }
+
+    Matrix forward(Matrix& input) override;
+    Matrix backward(Matrix& input, Matrix& output, Matrix& error,
+                    float learningRate) override;
+
+    FeatureLayer* copy() override;
+    void save(std::fstream& file) override;
+
+    // kernels, one row for each filter
+    Matrix* getWeights() { return m_weights; }
+    // one bias for each filter
+    Matrix* getBiases() { return m_biases; }
+
+private:
+    // unrolls every patch of the input into a column
+    Matrix im2col(Matrix& input);
+    // reverse of im2col, adding together values that overlapped
+    Matrix col2im(Matrix& cols);
+
+    int m_channels;
+    int m_height;
+    int m_width;
+    int m_filters;
+    int m_kernel;
+    int m_stride;
+    int m_padding;
+
+    int m_outHeight;
+    int m_outWidth;
+
+    Matrix* m_weights;
+    Matrix* m_biases;
+};
+
+/***
+ * @brief Max or average pooling over square windows that don't overlap
+ */
+class PoolLayer : public FeatureLayer
+{
+public:
+    /***
+     * @param channels Number of input channels
+     * @param height Input height
+     * @param width Input width
+     * @param size Width and height of each window, any leftover rows or
+     *          columns are ignored
+     * @param type LAYER_POOL_MAX or LAYER_POOL_AVG
+     */
+    PoolLayer(int channels, int height, int width, int size, int type);
+
+    int getType() override { return m_type; }
+    int getInputSize() override { return m_channels * m_height * m_width; }
+    int getOutputSize() override { return m_channels * m_outHeight * m_outWidth; }
+    long long getFlops() override;
+
+    int getOutputHeight() { return m_outHeight; }
+    int getOutputWidth() { return m_outWidth; }
+
+    Matrix forward(Matrix& input) override;
+    Matrix backward(Matrix& input, Matrix& output, Matrix& error,
+                    float learningRate) override;
+
+    FeatureLayer* copy() override;
+    void save(std::fstream& file) override;
+
+private:
+    int m_channels;
+    int m_height;
+    int m_width;
+    int m_size;
+    int m_type;
+
+    int m_outHeight;
+    int m_outWidth;
+};
@@ -0,0 +1,167 @@
+#include "dataparallel.hpp"
+
+#include "allreduce.hpp"
+#include "matrix.hpp"
+#include "nn.hpp"
+
+// copies every value of the matrices into one array, one after the other
+static void flatten(Matrix& a, Matrix& b, std::vector<float>& out)
+{
+    out.resize(a.getRows()*a.getColumns() + b.getRows()*b.getColumns());
+
+    int i = 0;
+    for(int y = 0; y < a.getRows(); ++y)
+        for(int x = 0; x < a.getColumns(); ++x)
+            out[i++] = a[y][x];
+    for(int y = 0; y < b.getRows(); ++y)
+        for(int x = 0; x < b.getColumns(); ++x)
+            out[i++] = b[y][x];
+}
+
+// reverse of flatten
+static void unflatten(std::vector<float> const& in, Matrix& a, Matrix& b)
+{
+    int i = 0;
+    for(int y = 0; y < a.getRows(); ++y)
+        for(int x = 0; x < a.getColumns(); ++x)
+            a[y][x] = in[i++];
+    for(int y = 0; y < b.getRows(); ++y)
+        for(int x = 0; x < b.getColumns(); ++x)
+            b[y][x] = in[i++];
+}
+
+DataParallelTrainer::DataParallelTrainer(NeuralNetwork* network,
+                                         RingAllReduce* ring)
+{
+    m_network = network;
+    m_ring = ring;
+    m_layerCount = network->getLayerCount();
+
+    m_weightGrads = new Matrix[m_layerCount];
+    m_biasGrads = new Matrix[m_layerCount];
+    m_buffers.resize(m_layerCount);
+
+    m_doneCount = 0;
+    m_failed = false;
+    m_stopping = false;
+
+    m_thread = std::thread(&DataParallelTrainer::communicate, this);
+}
+
+DataParallelTrainer::~DataParallelTrainer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+
+    delete[] m_weightGrads;
+    delete[] m_biasGrads;
+}
+
+bool DataParallelTrainer::synchronize()
+{
+    // summing rank 0's values with zeroes from everyone else gives
+    //  everyone rank 0's values
+    std::vector<float> buffer;
+    for(int i = 0; i < m_layerCount; ++i)
+    {
+        Matrix& weights = *m_network->getWeights(i);
+        Matrix& biases = *m_network->getBiases(i);
+
+        flatten(weights, biases, buffer);
+        if(m_ring->getRank() != 0)
+            for(float& value : buffer)
+                value = 0.0f;
+
+        if(!m_ring->allReduce(buffer.data(), (int)buffer.size()))
+            return false;
+        unflatten(buffer, weights, biases);
+    }
+    m_network->markWeightsChanged();
+    return true;
+}
+
+bool DataParallelTrainer::train(float const* inputs, float const* targets,
+                                int count)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_doneCount = 0;
+    }
+
+    m_network->computeGradients(inputs, targets, count, m_weightGrads,
+                                m_biasGrads, &onLayerDone, this);
+
+    // the first layers are usually still being sent at this point
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wake.wait(lock, [this]
+        {
+            return m_doneCount == m_layerCount;
+        });
+        if(m_failed)
+            return false;
+    }
+
+    // average over every sample in the whole batch
+    int total = count * m_ring->getWorldSize();
+    m_network->applyGradients(m_weightGrads, m_biasGrads, 1.0f / total);
+    return true;
+}
+
+void DataParallelTrainer::onLayerDone(int layer, void* userData)
+{
+    auto trainer = (DataParallelTrainer*)userData;
+    {
+        std::lock_guard<std::mutex> lock(trainer->m_mutex);
+        trainer->m_ready.push_back(layer);
+    }
+    trainer->m_wake.notify_all();
+}
+
+void DataParallelTrainer::communicate()
+{
+    while(true)
+    {
+        int layer;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this]
+            {
+                return m_stopping || !m_ready.empty();
+            });
+            if(m_ready.empty())
+                return;
+
+            layer = m_ready.front();
+            m_ready.erase(m_ready.begin());
+        }
+
+        // once the ring breaks the rest are just marked done so train
+        //  doesn't wait forever
+        bool ok;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ok = !m_failed;
+        }
+        if(ok)
+        {
+            std::vector<float>& buffer = m_buffers[layer];
+            flatten(m_weightGrads[layer], m_biasGrads[layer], buffer);
+            ok = m_ring->allReduce(buffer.data(), (int)buffer.size());
+            if(ok)
+                unflatten(buffer, m_weightGrads[layer], m_biasGrads[layer]);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(!ok)
+                m_failed = true;
+            m_doneCount++;
+        }
+        m_wake.notify_all();
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Matrix;
+class NeuralNetwork;
+class RingAllReduce;
+
+/***
+ * @brief Trains copies of the same network in several processes at once
+ *          Each process works out the changes for its share of a batch,
+ *          the changes are summed across processes through a ring
+ *          all-reduce and every copy applies the same total, so the copies
+ *          never drift apart
+ *          Each layer's changes start being sent as soon as backpropagation
+ *          has finished with it, while the layers before it are still being
+ *          worked out
+ */
+class DataParallelTrainer
+{
+public:
+    /***
+     * @param network This process's copy of the network
+     * @param ring Connected ring of every process taking part
+     */
+    DataParallelTrainer(NeuralNetwork* network, RingAllReduce* ring);
+    ~DataParallelTrainer();
+
+    DataParallelTrainer(DataParallelTrainer const&) = delete;
+    DataParallelTrainer& operator=(DataParallelTrainer const&) = delete;
+
+    /***
+     * @brief Makes every process's network the same as rank 0's, should be
+     *          called once before training
+     * @return Whether or not it worked
+     */
+    bool synchronize();
+
+    /***
+     * @brief Trains on this process's share of one batch
+     *          Every process must use the same count
+     * @param inputs count*inputs floats
+     * @param targets count*outputs floats
+     * @param count Number of samples this process has
+     * @return Whether or not it worked, false means the ring is broken
+     */
+    bool train(float const* inputs, float const* targets, int count);
+
+private:
+    // called by computeGradients when a layer is ready to send
+    static void onLayerDone(int layer, void* userData);
+    // sums layers' changes across processes as they're handed over
+    void communicate();
+
+    NeuralNetwork* m_network;
+    RingAllReduce* m_ring;
+    int m_layerCount;
+
+    // changes for each layer, owned by whichever thread the layer is with
+    Matrix* m_weightGrads;
+    Matrix* m_biasGrads;
+    // every layer's changes flattened for sending
+    std::vector<std::vector<float>> m_buffers;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    // layers waiting to be summed, and how many have finished
+    std::vector<int> m_ready;
+    int m_doneCount;
+    bool m_failed;
+    bool m_stopping;
+};
@@ -0,0 +1,255 @@
+#include "gemv.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__GNUC__)
+#define GEMV_PREFETCH(address) __builtin_prefetch((address), 0, 0)
+#else
+#define GEMV_PREFETCH(address)
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GEMV_PAUSE() _mm_pause()
+#else
+#define GEMV_PAUSE()
+#endif
+
+// how many times a helper checks for work before going to sleep, sleeping
+//  and being woken again costs tens of microseconds
+#define GEMV_SPIN_COUNT 20000
+
+/***
+ * @brief Helper threads shared by every big multiply
+ *          Only one multiply can use them at a time, anything that comes
+ *          along while they're busy just runs on its own thread
+ */
+class GemvPool
+{
+public:
+    GemvPool()
+    {
+        m_generation = 0;
+        m_stop = false;
+        m_job = nullptr;
+    }
+
+    ~GemvPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for(auto& thread : m_threads)
+            thread.join();
+    }
+
+    /***
+     * @brief Splits a multiply between the calling thread and up to
+     *          threads-1 helpers
+     * @return Whether it was done, false if the helpers were busy
+     */
+    bool run(PackedMatrix* matrix, float const* input, float const* bias,
+             float* output, int panels, int threads)
+    {
+        std::unique_lock<std::mutex> dispatch(m_dispatch, std::try_to_lock);
+        if(!dispatch.owns_lock())
+            return false;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            while((int)m_threads.size() < threads-1)
+                m_threads.emplace_back(&GemvPool::helperLoop, this);
+        }
+
+        Job job;
+        job.matrix = matrix;
+        job.input = input;
+        job.bias = bias;
+        job.output = output;
+        job.panels = panels;
+        job.chunks = threads;
+        job.next = 0;
+        job.remaining = threads;
+        job.active = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_job = &job;
+            m_generation++;
+        }
+        m_wake.notify_all();
+
+        // this thread works on it too, then waits for the rest
+        work(job);
+        while(job.remaining.load(std::memory_order_acquire) > 0)
+            GEMV_PAUSE();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_job = nullptr;
+        }
+        // helpers that picked the job up late still hold a pointer to it
+        while(job.active.load(std::memory_order_acquire) > 0)
+            GEMV_PAUSE();
+        return true;
+    }
+
+private:
+    struct Job
+    {
+        PackedMatrix* matrix;
+        float const* input;
+        float const* bias;
+        float* output;
+        int panels;
+        int chunks;
+        std::atomic<int> next;
+        std::atomic<int> remaining;
+        // helpers that are looking at the job
+        std::atomic<int> active;
+    };
+
+    // takes chunks of panels until there are none left
+    static void work(Job& job)
+    {
+        while(true)
+        {
+            int chunk = job.next.fetch_add(1);
+            if(chunk >= job.chunks)
+                return;
+
+            int first = (int)((long long)job.panels * chunk / job.chunks);
+            int last = (int)((long long)job.panels * (chunk+1) / job.chunks);
+            job.matrix->multiplyPanels(job.input, job.bias, job.output,
+                                       first, last);
+            job.remaining.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    void helperLoop()
+    {
+        long long seen = 0;
+        while(true)
+        {
+            // spin for a bit first since requests tend to come in bursts
+            for(int i = 0; i < GEMV_SPIN_COUNT; ++i)
+            {
+                if(m_generation.load(std::memory_order_acquire) != seen)
+                    break;
+                GEMV_PAUSE();
+            }
+
+            Job* job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [this, seen]
+                {
+                    return m_stop || m_generation != seen;
+                });
+                if(m_stop)
+                    return;
+                seen = m_generation;
+                job = m_job;
+                // the job can already be finished and cleared by the time
+                //  this thread gets to it
+                if(job)
+                    job->active++;
+            }
+
+            if(job)
+            {
+                work(*job);
+                job->active.fetch_sub(1, std::memory_order_release);
+            }
+        }
+    }
+
+    // held by whichever multiply is using the helpers
+    std::mutex m_dispatch;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::vector<std::thread> m_threads;
+    std::atomic<long long> m_generation;
+    bool m_stop;
+    Job* m_job;
+};
+
+static GemvPool s_pool;
+
+PackedMatrix::PackedMatrix(Matrix& mat)
+        : m_rowCount(mat.getRows()), m_colCount(mat.getColumns()),
+          m_panels((mat.getRows() + GEMV_PANEL_ROWS - 1) / GEMV_PANEL_ROWS,
+                   mat.getColumns() * GEMV_PANEL_ROWS)
+{
+    for(int r = 0; r < m_rowCount; ++r)
+    {
+        float* panel = m_panels[r / GEMV_PANEL_ROWS];
+        int offset = r % GEMV_PANEL_ROWS;
+        for(int c = 0; c < m_colCount; ++c)
+            panel[c*GEMV_PANEL_ROWS + offset] = mat[r][c];
+    }
+}
+
+void PackedMatrix::multiply(float const* input, float const* bias,
+                            float* output, int threads)
+{
+    int panels = m_panels.getRows();
+    if(threads > panels)
+        threads = panels;
+
+    long long weights = (long long)m_rowCount * m_colCount;
+    if(threads > 1 && weights >= GEMV_SPLIT_MIN_WEIGHTS
+       && s_pool.run(this, input, bias, output, panels, threads))
+        return;
+
+    multiplyPanels(input, bias, output, 0, panels);
+}
+
+void PackedMatrix::multiplyPanels(float const* input, float const* bias,
+                                  float* output, int first, int last)
+{
+    for(int p = first; p < last; ++p)
+    {
+        float const* panel = m_panels[p];
+
+        // two sets of accumulators, one for even columns and one for odd
+        //  ones, so the adds don't all wait on each other
+        float even[GEMV_PANEL_ROWS] = {};
+        float odd[GEMV_PANEL_ROWS] = {};
+
+        int c = 0;
+        for(; c+1 < m_colCount; c += 2)
+        {
+            // two columns of a panel are 64 bytes, a cache line's worth
+            float const* weights = panel + c*GEMV_PANEL_ROWS;
+            GEMV_PREFETCH(weights + GEMV_PREFETCH_DISTANCE);
+
+            float a = input[c];
+            float b = input[c+1];
+            for(int r = 0; r < GEMV_PANEL_ROWS; ++r)
+                even[r] += weights[r] * a;
+            for(int r = 0; r < GEMV_PANEL_ROWS; ++r)
+                odd[r] += weights[GEMV_PANEL_ROWS + r] * b;
+        }
+        if(c < m_colCount)
+        {
+            float const* weights = panel + c*GEMV_PANEL_ROWS;
+            for(int r = 0; r < GEMV_PANEL_ROWS; ++r)
+                even[r] += weights[r] * input[c];
+        }
+
+        int row = p * GEMV_PANEL_ROWS;
+        int rows = m_rowCount - row;
+        if(rows > GEMV_PANEL_ROWS)
+            rows = GEMV_PANEL_ROWS;
+        for(int r = 0; r < rows; ++r)
+            output[row + r] = even[r] + odd[r] + (bias ? bias[row + r] : 0.0f);
+    }
+}
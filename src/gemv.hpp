@@ -0,0 +1,63 @@
+#pragma once
+
+#include "matrix.hpp"
+
+// rows of the weights interleaved into each panel, 8 floats is one AVX
+//  register or two SSE ones
+#define GEMV_PANEL_ROWS 8
+// how far ahead to prefetch in a panel, in floats (1KB)
+#define GEMV_PREFETCH_DISTANCE 256
+// layers with fewer weights than this are never split between threads,
+//  waking the helpers costs more than it saves
+#define GEMV_SPLIT_MIN_WEIGHTS (256 * 1024)
+
+/***
+ * @brief A copy of a weight matrix laid out for multiplying by one column
+ *          Every GEMV_PANEL_ROWS rows are interleaved into a panel so that
+ *          each column of the panel is one contiguous run of floats, which
+ *          lets the multiply stream through memory in order and keep one
+ *          accumulator per row
+ *          It's a snapshot, changing the original matrix doesn't change it
+ */
+class PackedMatrix
+{
+public:
+    /***
+     * @brief Packs a matrix
+     * @param mat Weight matrix to copy
+     */
+    explicit PackedMatrix(Matrix& mat);
+
+    PackedMatrix(PackedMatrix const&) = delete;
+    PackedMatrix& operator=(PackedMatrix const&) = delete;
+
+    /***
+     * @brief Works out weights*input+bias for a single column
+     * @param input getColumns() floats
+     * @param bias getRows() floats added to the result, can be nullptr
+     * @param output getRows() floats to write the result to
+     * @param threads Most threads to split the rows between, only used for
+     *          layers with at least GEMV_SPLIT_MIN_WEIGHTS weights
+     */
+    void multiply(float const* input, float const* bias, float* output,
+                  int threads = 1);
+
+    int getRows() { return m_rowCount; }
+    int getColumns() { return m_colCount; }
+
+    /***
+     * @brief Runs a range of panels, used by the threads sharing a multiply
+     * @param first Index of the first panel
+     * @param last One past the index of the last panel
+     */
+    void multiplyPanels(float const* input, float const* bias, float* output,
+                        int first, int last);
+
+private:
+    int m_rowCount;
+    int m_colCount;
+
+    // one row per panel, GEMV_PANEL_ROWS*columns floats, column by column
+    //  with rows past the end of the matrix left as 0
+    Matrix m_panels;
+};
@@ -1,6 +1,7 @@
 #include "gmath.h"
 
 #include <cstdlib>
+#include <cstring>
 
 float randBetween(float min, float max)
 {
@@ -23,3 +24,36 @@ float map(float v, float vMin, float vMax, float oMin, float oMax)
     // apply that percentage to the new range
     return oMin + (perc * oDif);
 }
+
+uint64_t hashWords(void const* words, size_t count)
+{
+    // copied out a word at a time so the bits of anything can be hashed
+    auto bytes = (unsigned char const*)words;
+    uint64_t a = 0x9e3779b97f4a7c15ULL;
+    uint64_t b = 0xc2b2ae3d27d4eb4fULL;
+
+    size_t i = 0;
+    for(; i+1 < count; i += 2)
+    {
+        uint32_t x;
+        uint32_t y;
+        memcpy(&x, bytes + i*4, 4);
+        memcpy(&y, bytes + i*4 + 4, 4);
+        a = (a ^ x) * 0xff51afd7ed558ccdULL;
+        a = (a << 31) | (a >> 33);
+        b = (b ^ y) * 0xc4ceb9fe1a85ec53ULL;
+        b = (b << 29) | (b >> 35);
+    }
+    if(i < count)
+    {
+        uint32_t x;
+        memcpy(&x, bytes + i*4, 4);
+        a = (a ^ x) * 0xff51afd7ed558ccdULL;
+    }
+
+    uint64_t hash = a ^ (b * 0x9e3779b97f4a7c15ULL) ^ count;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 #define PI 3.141592653589793238f
 
 inline int sign(float n) { return n < 0 ? -1 : 1; }
@@ -28,3 +31,13 @@ float randBetween(float min, float max);
  */
 float map(float v, float vMin, float vMax, float oMin, float oMax);
 
+/***
+ * @brief Quick non-cryptographic 64 bit hash of some 32 bit words, two
+ *          independent lanes of multiply and rotate mixed at the end
+ *          Checkpoint deltas save it, so it can't change
+ * @param words The words to hash, which can be the bits of floats
+ * @param count Number of words
+ * @return The hash
+ */
+uint64_t hashWords(void const* words, size_t count);
+
@@ -0,0 +1,195 @@
+#include "guesscache.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+#include "gmath.h"
+#include "nn.hpp"
+
+GuessCache::GuessCache(long long maxBytes, float precision, int shards)
+{
+    if(shards < 1)
+        shards = 1;
+
+    m_shardBytes = maxBytes / shards;
+    m_precision = precision > 0.0f ? precision : 0.0f;
+
+    for(int i = 0; i < shards; ++i)
+    {
+        auto shard = new Shard;
+        shard->bytes = 0;
+        shard->version = 0;
+        m_shards.push_back(shard);
+    }
+
+    m_hits = 0;
+    m_misses = 0;
+    m_evictions = 0;
+    m_invalidations = 0;
+}
+
+GuessCache::~GuessCache()
+{
+    for(Shard* shard : m_shards)
+        delete shard;
+}
+
+bool GuessCache::guess(NeuralNetwork* network, float const* input,
+                       float* output)
+{
+    int inputCount = network->getInputCount();
+    int outputCount = network->getOutputCount();
+
+    Entry entry;
+    makeKey(input, inputCount, entry.key);
+    entry.hash = hashWords(entry.key.data(), entry.key.size());
+
+    // the low bits pick the bucket in the shard's map, so use the high
+    //  ones to pick the shard
+    Shard& shard = *m_shards[(entry.hash >> 48) % m_shards.size()];
+    long long version = network->getWeightVersion();
+
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if(shard.version != version)
+        {
+            clearShard(shard);
+            shard.version = version;
+        }
+
+        auto found = shard.index.find(entry.hash);
+        if(found != shard.index.end() && found->second->key == entry.key)
+        {
+            // move it to the front as the most recently used
+            shard.entries.splice(shard.entries.begin(), shard.entries,
+                                 found->second);
+            memcpy(output, found->second->output.data(),
+                   outputCount * sizeof(float));
+            m_hits++;
+            return true;
+        }
+    }
+
+    // guess without holding the lock, so other threads can still use the
+    //  shard in the meantime
+    m_misses++;
+    network->guess(input, output);
+    entry.output.assign(output, output + outputCount);
+
+    long long bytes = entryBytes(entry);
+    if(bytes > m_shardBytes)
+        return false;
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    // the network changed while guessing, so this output is already stale
+    if(shard.version != version)
+        return false;
+
+    // another thread might have put it in first, or it's a different input
+    //  with the same hash, either way the newest one wins
+    auto found = shard.index.find(entry.hash);
+    if(found != shard.index.end())
+    {
+        shard.bytes -= entryBytes(*found->second);
+        shard.entries.erase(found->second);
+        shard.index.erase(found);
+    }
+
+    shard.entries.push_front(std::move(entry));
+    shard.index[shard.entries.front().hash] = shard.entries.begin();
+    shard.bytes += bytes;
+
+    while(shard.bytes > m_shardBytes)
+    {
+        Entry& last = shard.entries.back();
+        shard.bytes -= entryBytes(last);
+        shard.index.erase(last.hash);
+        shard.entries.pop_back();
+        m_evictions++;
+    }
+
+    return false;
+}
+
+void GuessCache::clear()
+{
+    for(Shard* shard : m_shards)
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->entries.clear();
+        shard->index.clear();
+        shard->bytes = 0;
+    }
+}
+
+GuessCacheStats GuessCache::getStats()
+{
+    GuessCacheStats stats;
+    stats.hits = m_hits;
+    stats.misses = m_misses;
+    stats.evictions = m_evictions;
+    stats.invalidations = m_invalidations;
+    stats.entries = 0;
+    stats.bytes = 0;
+
+    for(Shard* shard : m_shards)
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        stats.entries += (long long)shard->entries.size();
+        stats.bytes += shard->bytes;
+    }
+    return stats;
+}
+
+double GuessCache::getHitRate()
+{
+    long long hits = m_hits;
+    long long total = hits + m_misses;
+    return total > 0 ? (double)hits / total : 0.0;
+}
+
+void GuessCache::resetStats()
+{
+    m_hits = 0;
+    m_misses = 0;
+    m_evictions = 0;
+    m_invalidations = 0;
+}
+
+void GuessCache::makeKey(float const* input, int count,
+                         std::vector<uint32_t>& key)
+{
+    key.resize(count);
+
+    if(m_precision <= 0.0f)
+    {
+        // the exact bits, so -0 and 0 are different inputs
+        memcpy(key.data(), input, count * sizeof(float));
+        return;
+    }
+
+    float scale = 1.0f / m_precision;
+    for(int i = 0; i < count; ++i)
+        key[i] = (uint32_t)(int32_t)lrintf(input[i] * scale);
+}
+
+long long GuessCache::entryBytes(Entry const& entry)
+{
+    // the entry in its list node, the map node, and the two arrays
+    long long bytes = sizeof(Entry) + 2 * sizeof(void*);
+    bytes += sizeof(uint64_t) + sizeof(std::list<Entry>::iterator)
+             + 2 * sizeof(void*);
+    bytes += entry.key.capacity() * sizeof(uint32_t);
+    bytes += entry.output.capacity() * sizeof(float);
+    return bytes;
+}
+
+void GuessCache::clearShard(Shard& shard)
+{
+    m_invalidations += (long long)shard.entries.size();
+    shard.entries.clear();
+    shard.index.clear();
+    shard.bytes = 0;
+}
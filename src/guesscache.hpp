@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+class NeuralNetwork;
+
+/***
+ * @brief Counters from a GuessCache
+ */
+struct GuessCacheStats
+{
+    long long hits;
+    long long misses;
+    // entries thrown out to stay under the memory limit
+    long long evictions;
+    // entries thrown out because the network changed
+    long long invalidations;
+
+    long long entries;
+    // rough memory used by the entries, including the bookkeeping
+    long long bytes;
+};
+
+/***
+ * @brief Remembers the outputs of recent guesses so the same input doesn't
+ *          go through the network twice
+ *          Inputs are matched exactly, or after rounding each value to a
+ *          multiple of a precision so inputs that are nearly the same share
+ *          an entry (the first one guessed is the output they all get)
+ *          Least recently used entries are thrown out once the cache goes
+ *          over its memory limit, and everything is thrown out when the
+ *          network's weights change (see NeuralNetwork::getWeightVersion),
+ *          including when a different network is used
+ *          Safe to use from several threads at once, the entries are split
+ *          between shards which each have their own lock
+ */
+class GuessCache
+{
+public:
+    /***
+     * @param maxBytes Most memory to use for entries
+     * @param precision Inputs are rounded to a multiple of this before
+     *          being matched, 0 matches them exactly
+     * @param shards How many pieces to split the cache into, more means
+     *          less waiting on locks between threads
+     */
+    GuessCache(long long maxBytes, float precision = 0.0f, int shards = 16);
+    ~GuessCache();
+
+    GuessCache(GuessCache const&) = delete;
+    GuessCache& operator=(GuessCache const&) = delete;
+
+    /***
+     * @brief Gets a network's guess from the cache, or from the network if
+     *          it's not cached yet
+     * @param network Network to guess with
+     * @param input getInputCount() floats
+     * @param output Array of getOutputCount() floats for the result
+     * @return Whether the output came from the cache
+     */
+    bool guess(NeuralNetwork* network, float const* input, float* output);
+
+    /***
+     * @brief Throws out every entry
+     */
+    void clear();
+
+    /***
+     * @return The cache's counters so far
+     */
+    GuessCacheStats getStats();
+    /***
+     * @return Fraction of guesses that came from the cache
+     */
+    double getHitRate();
+    /***
+     * @brief Sets the hit, miss, eviction and invalidation counters to 0
+     */
+    void resetStats();
+
+private:
+    struct Entry
+    {
+        uint64_t hash;
+        std::vector<uint32_t> key;
+        std::vector<float> output;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        // most recently used at the front
+        std::list<Entry> entries;
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+        long long bytes;
+        // weight version of the network the entries came from
+        long long version;
+    };
+
+    // turns an input into what's matched, rounding it if there's a precision
+    void makeKey(float const* input, int count, std::vector<uint32_t>& key);
+    // memory an entry takes up, counting the list and map nodes
+    static long long entryBytes(Entry const& entry);
+    // throws out everything in a shard, the shard has to be locked
+    void clearShard(Shard& shard);
+
+    std::vector<Shard*> m_shards;
+    long long m_shardBytes;
+    float m_precision;
+
+    std::atomic<long long> m_hits;
+    std::atomic<long long> m_misses;
+    std::atomic<long long> m_evictions;
+    std::atomic<long long> m_invalidations;
+};
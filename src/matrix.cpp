@@ -2,103 +2,199 @@
 
 #include "gmath.h"
 
-Matrix::Matrix(int rows, int cols)
-        : m_rowCount(rows), m_colCount(cols)
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+// how many heap allocations matrices have made on this thread, for
+//  profiling, kept per thread so counting costs no shared cache line
+static thread_local long long s_allocations = 0;
+
+// where matrix storage comes from, see Matrix::setAllocationPolicy
+static std::atomic<int> s_policy(ALLOC_NORMAL);
+static std::atomic<long long> s_hugePageMinBytes(MATRIX_HUGE_PAGE_SIZE);
+static std::atomic<long long> s_hugePageBytes(0);
+
+// maps a region of at least bytes backed by huge pages, rounded up to a
+//  whole number of them, returns nullptr if that isn't possible
+static float* mapHugePages(long long bytes, long long* mapped)
+{
+#ifdef __linux__
+    size_t length = (size_t)((bytes + MATRIX_HUGE_PAGE_SIZE - 1)
+                             / MATRIX_HUGE_PAGE_SIZE * MATRIX_HUGE_PAGE_SIZE);
+
+    if (s_policy == ALLOC_HUGE_PAGES)
+    {
+        void* region = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (region != MAP_FAILED)
+        {
+            *mapped = (long long)length;
+            return (float*)region;
+        }
+        // nothing reserved in /proc/sys/vm/nr_hugepages, so fall back to
+        //  transparent huge pages
+    }
+
+    // the kernel only uses a huge page for an aligned 2MB range, so map an
+    //  extra page and trim the region down to start on a boundary
+    size_t padded = length + MATRIX_HUGE_PAGE_SIZE;
+    void* region = mmap(nullptr, padded, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED)
+        return nullptr;
+
+    char* start = (char*)region;
+    char* aligned = (char*)(((uintptr_t)start + MATRIX_HUGE_PAGE_SIZE - 1)
+                            & ~(uintptr_t)(MATRIX_HUGE_PAGE_SIZE - 1));
+    if (aligned > start)
+        munmap(start, aligned - start);
+    size_t tail = (start + padded) - (aligned + length);
+    if (tail > 0)
+        munmap(aligned + length, tail);
+
+    // if transparent huge pages are turned off this fails and the region
+    //  just stays on normal pages, which is still fine to use
+    madvise(aligned, length, MADV_HUGEPAGE);
+
+    *mapped = (long long)length;
+    return (float*)aligned;
+#else
+    (void)bytes;
+    (void)mapped;
+    return nullptr;
+#endif
+}
+
+void Matrix::create(int rows, int cols)
 {
+    m_rowCount = rows;
+    m_colCount = cols;
+    m_values = nullptr;
+    m_data = nullptr;
+    m_mappedBytes = 0;
+
+    if (rows <= 0)
+        return;
+
+    // every row points into one block so the values are contiguous
     m_values = new float* [rows];
+    s_allocations++;
+
+    long long count = (long long)rows * (cols > 0 ? cols : 0);
+    long long bytes = count * (long long)sizeof(float);
+    if (count > 0)
+    {
+        if (s_policy != ALLOC_NORMAL && bytes >= s_hugePageMinBytes)
+        {
+            // mapped memory is already zeroed
+            m_data = mapHugePages(bytes, &m_mappedBytes);
+            if (m_data)
+                s_hugePageBytes += m_mappedBytes;
+        }
+        if (!m_data)
+        {
+            // initialize all elements to 0
+            m_data = new float[count]();
+            m_mappedBytes = 0;
+        }
+        s_allocations++;
+    }
 
-    // initialize all elements to 0
     for (int i = 0; i < rows; ++i)
+        m_values[i] = m_data + (long long)i * cols;
+}
+
+void Matrix::destroy()
+{
+    if (m_mappedBytes > 0)
     {
-        m_values[i] = new float[cols];
-        for (int j = 0; j < cols; ++j)
-            m_values[i][j] = 0.0f;
+#ifdef __linux__
+        munmap(m_data, (size_t)m_mappedBytes);
+#endif
+        s_hugePageBytes -= m_mappedBytes;
+    }
+    else
+    {
+        delete[] m_data;
     }
+    delete[] m_values;
+
+    m_values = nullptr;
+    m_data = nullptr;
+    m_mappedBytes = 0;
+}
+
+Matrix::Matrix(int rows, int cols)
+{
+    create(rows, cols);
 }
 
 Matrix::~Matrix()
 {
-    for (int i = 0; i < m_rowCount; ++i)
-        delete[] m_values[i];
-    if (m_rowCount > 0)
-        delete[] m_values;
+    destroy();
 }
 
 // Copy constructor
 Matrix::Matrix(Matrix& mat)
 {
-    mat.getSize(&m_rowCount, &m_colCount);
-
-    m_values = new float* [m_rowCount];
-    for (int i = 0; i < m_rowCount; ++i)
-    {
-        m_values[i] = new float[m_colCount];
-        for (int j = 0; j < m_colCount; ++j)
-            m_values[i][j] = mat[i][j];
-    }
+    create(mat.getRows(), mat.getColumns());
+    if (m_data)
+        memcpy(m_data, mat.m_data,
+               (size_t)m_rowCount * m_colCount * sizeof(float));
 }
 
 // Copy assignment operator
 Matrix& Matrix::operator=(Matrix const& mat)
 {
-    for (int i = 0; i < m_rowCount; ++i)
-        delete[] m_values[i];
-    if (m_rowCount > 0)
-        delete[] m_values;
-
-    mat.getSize(&m_rowCount, &m_colCount);
-
-    float** matVals = mat._getArray();
+    if (&mat == this)
+        return *this;
 
-    m_values = new float* [m_rowCount];
-    for (int i = 0; i < m_rowCount; ++i)
+    // keep the storage we already have if it's the right size
+    if (mat.m_rowCount != m_rowCount || mat.m_colCount != m_colCount)
     {
-        m_values[i] = new float[m_colCount];
-        for (int j = 0; j < m_colCount; ++j)
-            m_values[i][j] = matVals[i][j];
+        destroy();
+        create(mat.m_rowCount, mat.m_colCount);
     }
 
+    if (m_data)
+        memcpy(m_data, mat.m_data,
+               (size_t)m_rowCount * m_colCount * sizeof(float));
+
     return *this;
 }
 
 // Move constructor
 Matrix::Matrix(Matrix&& mat) noexcept
 {
-    mat.getSize(&m_rowCount, &m_colCount);
-
-    m_values = new float* [m_rowCount];
-    for (int i = 0; i < m_rowCount; ++i)
-    {
-        m_values[i] = new float[m_colCount];
-        for (int j = 0; j < m_colCount; ++j)
-        {
-            m_values[i][j] = mat[i][j];
-            mat[i][j] = 0.0f;
-        }
-    }
-
+    m_rowCount = mat.m_rowCount;
+    m_colCount = mat.m_colCount;
+    m_values = mat.m_values;
+    m_data = mat.m_data;
+    m_mappedBytes = mat.m_mappedBytes;
+
+    // the other matrix is left empty
+    mat.m_rowCount = 0;
+    mat.m_colCount = 0;
+    mat.m_values = nullptr;
+    mat.m_data = nullptr;
+    mat.m_mappedBytes = 0;
 }
 
 // Move assignment operator
 Matrix& Matrix::operator=(Matrix&& mat) noexcept
 {
-    for (int i = 0; i < m_rowCount; ++i)
-        delete[] m_values[i];
-    if (m_rowCount > 0)
-        delete[] m_values;
-
-    mat.getSize(&m_rowCount, &m_colCount);
-
-    m_values = new float* [m_rowCount];
-    for (int i = 0; i < m_rowCount; ++i)
-    {
-        m_values[i] = new float[m_colCount];
-        for (int j = 0; j < m_colCount; ++j)
-        {
-            m_values[i][j] = mat[i][j];
-            mat[i][j] = 0.0f;
-        }
-    }
+    // swap storage so the other matrix frees ours when it goes away
+    std::swap(m_rowCount, mat.m_rowCount);
+    std::swap(m_colCount, mat.m_colCount);
+    std::swap(m_values, mat.m_values);
+    std::swap(m_data, mat.m_data);
+    std::swap(m_mappedBytes, mat.m_mappedBytes);
 
     return *this;
 }
@@ -125,17 +221,65 @@ Matrix Matrix::product(Matrix& mat)
         return *this;
 
     Matrix m(m_rowCount, mat.getColumns());
-    for (int i = 0; i < m.getRows(); ++i)
+    productInto(mat, m);
+    return m;
+}
+
+bool Matrix::productInto(Matrix& mat, Matrix& result)
+{
+    // matrices must match columns/rows, and the result can't be one of the
+    //  matrices being multiplied since it's written as it goes
+    if (mat.getRows() != m_colCount
+        || result.getRows() != m_rowCount
+        || result.getColumns() != mat.getColumns()
+        || &result == this || &result == &mat)
+        return false;
+
+    // going along rows of the other matrix instead of down its columns
+    //  keeps every read in order, each result still adds up its k terms
+    //  in the same order as before
+
+    // four rows of the other matrix go into each pass along the result
+    //  row, so it's loaded and stored once for every four instead of every
+    //  one, they're still added one at a time so it rounds the same
+    int cols = mat.getColumns();
+    for (int i = 0; i < m_rowCount; ++i)
     {
-        for (int j = 0; j < m.getColumns(); ++j)
+        float* out = result[i];
+        float const* values = m_values[i];
+        for (int j = 0; j < cols; ++j)
+            out[j] = 0.0f;
+
+        int k = 0;
+        for (; k+3 < m_colCount; k += 4)
         {
-            float sum = 0.0f;
-            for (int k = 0; k < m_colCount; ++k)
-                sum += (m_values[i][k] * mat[k][j]);
-            m[i][j] = sum;
+            float v0 = values[k];
+            float v1 = values[k+1];
+            float v2 = values[k+2];
+            float v3 = values[k+3];
+            float const* r0 = mat[k];
+            float const* r1 = mat[k+1];
+            float const* r2 = mat[k+2];
+            float const* r3 = mat[k+3];
+            for (int j = 0; j < cols; ++j)
+            {
+                float sum = out[j];
+                sum += v0 * r0[j];
+                sum += v1 * r1[j];
+                sum += v2 * r2[j];
+                sum += v3 * r3[j];
+                out[j] = sum;
+            }
+        }
+        for (; k < m_colCount; ++k)
+        {
+            float value = values[k];
+            float const* row = mat[k];
+            for (int j = 0; j < cols; ++j)
+                out[j] += value * row[j];
         }
     }
-    return m;
+    return true;
 }
 
 void Matrix::map(ModifyFunction func)
@@ -282,6 +426,24 @@ Matrix& Matrix::operator*=(Matrix& mat)
     return *this;
 }
 
+Matrix& Matrix::addToColumns(Matrix& col)
+{
+    if (col.getRows() != m_rowCount || col.getColumns() != 1)
+    {
+        // not a column that fits this matrix
+        return *this;
+    }
+
+    for (int y = 0; y < m_rowCount; ++y)
+    {
+        float value = col[y][0];
+        for (int x = 0; x < m_colCount; ++x)
+            m_values[y][x] += value;
+    }
+
+    return *this;
+}
+
 bool Matrix::operator==(Matrix& mat)
 {
     if (mat.getRows() != m_rowCount
@@ -326,8 +488,7 @@ void Matrix::randomize()
 // default constructor which should never be used
 Matrix::Matrix()
 {
-    m_rowCount = -1;
-    m_colCount = -1;
+    create(0, 0);
 }
 
 void Matrix::mutate(float rate)
@@ -337,3 +498,24 @@ void Matrix::mutate(float rate)
             if (randBetween(0.0f, 1.0f) < rate)
                 m_values[y][x] = randBetween(-1.0f, 1.0f);
 }
+
+long long Matrix::getAllocationCount()
+{
+    return s_allocations;
+}
+
+void Matrix::setAllocationPolicy(MatrixAllocation policy, long long minBytes)
+{
+    s_policy = policy;
+    s_hugePageMinBytes = minBytes;
+}
+
+MatrixAllocation Matrix::getAllocationPolicy()
+{
+    return (MatrixAllocation)s_policy.load();
+}
+
+long long Matrix::getHugePageBytes()
+{
+    return s_hugePageBytes;
+}
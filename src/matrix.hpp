@@ -3,6 +3,24 @@
 // typedef a function pointer we'll be using in the map function
 typedef float(*ModifyFunction)(float n);
 
+// size of the huge pages matrix storage can be backed by
+#define MATRIX_HUGE_PAGE_SIZE (2LL * 1024 * 1024)
+
+/***
+ * @brief Where matrices get their storage from, see
+ *          Matrix::setAllocationPolicy
+ */
+enum MatrixAllocation
+{
+    // regular heap allocations
+    ALLOC_NORMAL,
+    // 2MB transparent huge pages, asked for with madvise
+    ALLOC_TRANSPARENT_HUGE_PAGES,
+    // explicitly reserved huge pages (MAP_HUGETLB), falling back to
+    //  transparent huge pages when none are reserved
+    ALLOC_HUGE_PAGES
+};
+
 class Matrix
 {
 public:
@@ -61,6 +79,15 @@ public:
      * @return A new matrix containing the product of the multiplication
      */
     Matrix product(Matrix& mat);
+    /***
+     * @brief Same as product but writes into a matrix that already exists,
+     *          so nothing is allocated
+     * @param mat Other matrix to get the product of
+     * @param result Matrix to write to, already the size of the product and
+     *          not either of the matrices being multiplied
+     * @return Whether or not the sizes matched
+     */
+    bool productInto(Matrix& mat, Matrix& result);
 
     /***
      * @brief Applies a function to each value in the matrix
@@ -142,6 +169,14 @@ public:
      */
     Matrix& operator*=(Matrix& mat);
 
+    /***
+     * @brief Adds a single column matrix to every column of this matrix
+     *          Used to add biases to a batch of inputs at once
+     * @param col Column matrix with the same number of rows as this matrix
+     * @return Reference to this which has had the column added to it
+     */
+    Matrix& addToColumns(Matrix& col);
+
     /***
      * @brief Checks if this matrix is equal to another one.
      * @param mat Matrix to test against
@@ -164,11 +199,50 @@ public:
      */
     inline float** _getArray() const { return m_values; }
 
+    /***
+     * @brief Gets how many heap allocations matrices have made on the
+     *          calling thread so far
+     *          Used by the profiler to count allocations between the start
+     *          and end of a layer, which run on the same thread
+     * @return Number of allocations on this thread
+     */
+    static long long getAllocationCount();
+
+    /***
+     * @brief Sets where matrices made from now on get their storage from
+     *          Big weight and activation matrices span thousands of 4KB
+     *          pages, backing them with 2MB huge pages cuts down on TLB
+     *          misses when multiplying them
+     *          Matrices smaller than minBytes always use the heap, and if
+     *          huge pages can't be had the heap is used instead
+     * @param policy Where to get the storage from
+     * @param minBytes Smallest matrix, in bytes, to use huge pages for
+     */
+    static void setAllocationPolicy(MatrixAllocation policy,
+                                    long long minBytes = MATRIX_HUGE_PAGE_SIZE);
+    /***
+     * @return The current allocation policy
+     */
+    static MatrixAllocation getAllocationPolicy();
+    /***
+     * @return How many bytes of matrix storage are currently mapped for
+     *          huge pages
+     */
+    static long long getHugePageBytes();
+
 private:
+    // allocates zeroed storage for a rows*cols matrix
+    void create(int rows, int cols);
+    // frees the storage, leaving the matrix empty
+    void destroy();
+
     // values to keep track of the size
     int m_rowCount;
     int m_colCount;
 
-    // the elements of the matrix
+    // the elements of the matrix, each row points into m_data
     float** m_values;
+    float* m_data;
+    // size of the mapping if m_data was mapped for huge pages, 0 otherwise
+    long long m_mappedBytes;
 };
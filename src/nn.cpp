@@ -3,8 +3,90 @@
 #include <iostream>
 #include <cmath>
 #include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <vector>
 
 #include "matrix.hpp"
+#include "gmath.h"
+#include "conv.hpp"
+#include "profiler.hpp"
+#include "gemv.hpp"
+#include "normalizer.hpp"
+
+// hands out weight versions, shared by every network so that no two
+//  networks ever have the same one
+static std::atomic<long long> s_weightVersions(0);
+
+// rough amount of work done feeding a batch of columns through a layer
+static void forwardCost(long long rows, long long cols, long long batch,
+                        long long* flops, long long* bytes)
+{
+    // multiply-add for every weight, then the bias and activation
+    *flops = batch * (2*rows*cols + 2*rows);
+    // weights and biases are read once, inputs read and outputs written
+    *bytes = 4 * (rows*cols + rows + batch*(cols + rows));
+}
+
+// rough amount of work done backpropagating a batch through a layer
+static void backwardCost(long long rows, long long cols, long long batch,
+                         bool passError, long long* flops, long long* bytes)
+{
+    // gradient and bias adjustment, then the weight delta and adjustment
+    *flops = batch * (4*rows + 2*rows*cols) + rows*cols;
+    // weight delta written and read, weights read and written
+    *bytes = 4 * (4*rows*cols + batch*(4*rows + cols));
+    if(passError)
+    {
+        // transposing the weights and multiplying the error through them
+        *flops += batch * 2*rows*cols;
+        *bytes += 4 * (3*rows*cols + batch*(rows + cols));
+    }
+}
+
+// rough amount of work done running one sample through a feature layer
+static void featureCost(FeatureLayer* layer, bool backward, long long* flops,
+                        long long* bytes)
+{
+    // the layer knows its own forward work, backward is about twice that
+    //  for the kernel gradients and the error passed back
+    *flops = layer->getFlops() * (backward ? 2 : 1);
+    // only the input and output are counted, the kernels are small
+    *bytes = 4LL * (layer->getInputSize() + layer->getOutputSize())
+             * (backward ? 3 : 1);
+}
+
+GuessWorkspace::GuessWorkspace()
+{
+    m_layers = nullptr;
+    m_layerCount = 0;
+}
+
+GuessWorkspace::~GuessWorkspace()
+{
+    for(int i = 0; i < m_layerCount; ++i)
+        delete m_layers[i];
+    delete[] m_layers;
+}
+
+Matrix& GuessWorkspace::get(int count, int index, int rows, int cols)
+{
+    if(count > m_layerCount)
+    {
+        auto layers = new Matrix*[count];
+        for(int i = 0; i < count; ++i)
+            layers[i] = i < m_layerCount ? m_layers[i] : new Matrix();
+        delete[] m_layers;
+        m_layers = layers;
+        m_layerCount = count;
+    }
+
+    Matrix& matrix = *m_layers[index];
+    if(matrix.getRows() != rows || matrix.getColumns() != cols)
+        matrix = Matrix(rows, cols);
+    return matrix;
+}
 
 NeuralNetwork::NeuralNetwork(int in, int hid, int const* nodes, int out)
 {
@@ -13,6 +95,24 @@ NeuralNetwork::NeuralNetwork(int in, int hid, int const* nodes, int out)
 
     m_hiddenLayers = hid;
 
+    m_profiler = nullptr;
+
+    m_featureLayers = nullptr;
+    m_featureLayerCount = 0;
+
+    m_checkpointInterval = 1;
+
+    m_loss = LOSS_MSE;
+    m_activationBytes = 0;
+    m_peakActivationBytes = 0;
+
+    m_packed = nullptr;
+    m_packedVersion = 0;
+    m_weightVersion = ++s_weightVersions;
+    m_guessThreads = 1;
+
+    m_normalizer = nullptr;
+
     // copy values from the nodes array
     m_hiddenNodeCount = new int[hid];
     for(int i = 0; i < hid; ++i)
@@ -62,26 +162,29 @@ NeuralNetwork::~NeuralNetwork()
     delete[] m_biases;
 
     delete[] m_hiddenNodeCount;
+
+    for(int i = 0; i < m_featureLayerCount; ++i)
+        delete m_featureLayers[i];
+    delete[] m_featureLayers;
+
+    freePackedWeights();
+    delete m_normalizer;
 }
 
 void NeuralNetwork::guess(float const* input, float* output)
 {
     // make a matrix from the input
-    //auto lastLayer = new Matrix(m_inputNodes, 1);
-    Matrix lastLayer = Matrix(m_inputNodes, 1);
-    for(int i = 0; i < m_inputNodes; ++i)
-        lastLayer[i][0] = input[i];
+    Matrix lastLayer = prepareInput(input, nullptr);
 
-    for(int i = 0; i < m_hiddenLayers+1; ++i)
+    if(hasPackedWeights())
     {
-        // take the input to these neurons and multiply them by the weights
-        auto layer = m_weights[i]->product(lastLayer);
-        // add biases separately, could also just be another weight
-        layer += *(m_biases[i]);
-        // scale between 0 and 1 using activation function
-        layer.map(&activtan);
-
-        lastLayer = layer;
+        for(int i = 0; i < m_hiddenLayers+1; ++i)
+            lastLayer = feedPackedLayer(i, lastLayer);
+    }
+    else
+    {
+        for(int i = 0; i < m_hiddenLayers+1; ++i)
+            lastLayer = feedLayer(i, lastLayer);
     }
     // now lastLayer is the matrix representing the output
 
@@ -90,53 +193,122 @@ void NeuralNetwork::guess(float const* input, float* output)
         output[i] = lastLayer[i][0];
 }
 
+void NeuralNetwork::guessBatch(float const* inputs, float* outputs,
+                               int count)
+{
+    GuessWorkspace workspace;
+    guessBatch(inputs, outputs, count, workspace);
+}
+
+void NeuralNetwork::guessBatch(float const* inputs, float* outputs,
+                               int count, GuessWorkspace& workspace)
+{
+    if(count <= 0)
+        return;
+
+    // a batch of one is just a guess, which can use the packed weights
+    if(count == 1)
+    {
+        guess(inputs, outputs);
+        return;
+    }
+
+    int matrixCount = m_hiddenLayers+2;
+
+    // each sample is a column so every layer is one matrix product
+    Matrix& input = workspace.get(matrixCount, 0, m_inputNodes, count);
+    if(m_featureLayerCount > 0)
+    {
+        // feature layers only take one sample at a time
+        int inputCount = getInputCount();
+        for(int s = 0; s < count; ++s)
+        {
+            Matrix features = prepareInput(inputs + s*inputCount, nullptr);
+            for(int i = 0; i < m_inputNodes; ++i)
+                input[i][s] = features[i][0];
+        }
+    }
+    else
+    {
+        for(int s = 0; s < count; ++s)
+            for(int i = 0; i < m_inputNodes; ++i)
+                input[i][s] = inputs[s*m_inputNodes + i];
+    }
+
+    Matrix* lastLayer = &input;
+    for(int i = 0; i < m_hiddenLayers+1; ++i)
+    {
+        Matrix& output = workspace.get(matrixCount, i+1,
+                                       m_weights[i]->getRows(), count);
+        if(!feedLayerInto(i, *lastLayer, output))
+        {
+            // zeros rather than the last batch's outputs
+            for(int j = 0; j < count*m_outputNodes; ++j)
+                outputs[j] = 0.0f;
+            return;
+        }
+        lastLayer = &output;
+    }
+
+    for(int s = 0; s < count; ++s)
+        for(int i = 0; i < m_outputNodes; ++i)
+            outputs[s*m_outputNodes + i] = (*lastLayer)[i][s];
+}
+
+void NeuralNetwork::guessSparse(int const* indices, float const* values,
+                                int count, float* output)
+{
+    if(m_featureLayerCount > 0)
+    {
+        // feature layers need the whole input anyway
+        float* input = makeDenseInput(indices, values, count);
+        guess(input, output);
+        delete[] input;
+        return;
+    }
+
+    Matrix lastLayer = feedSparseLayer(indices, values, count);
+
+    for(int i = 1; i < m_hiddenLayers+1; ++i)
+        lastLayer = feedLayer(i, lastLayer);
+
+    for(int i = 0; i < m_outputNodes; ++i)
+        output[i] = lastLayer[i][0];
+}
+
 void NeuralNetwork::propagate(float const* inputs, float const* targets)
 {
     // turn the inputs and targets into 1 column matrices
-    Matrix inputMatrix(m_inputNodes, 1);
+    // the feature layers' inputs and outputs are kept to adjust them later
+    Matrix* features = new Matrix[m_featureLayerCount+1];
+    Matrix inputMatrix = prepareInput(inputs, features);
     Matrix targetMatrix(m_outputNodes, 1);
 
-    for(int i = 0; i < m_inputNodes; ++i)
-        inputMatrix[i][0] = inputs[i];
     for(int i = 0; i < m_outputNodes; ++i)
         targetMatrix[i][0] = targets[i];
 
     // get the results of each layer
     // just feedforward (like the guess function) but keep track of layers
-    // I should probably put this feedforward stuff into a function and
-    //  use that for both this and guessing
-    Matrix* allLayers = new Matrix[m_hiddenLayers+1];
-    Matrix lastLayer = inputMatrix;
-    for(int i = 0; i < m_hiddenLayers+1; ++i)
-    {
-        auto layer = m_weights[i]->product(lastLayer);
-        layer += *(m_biases[i]);
-        layer.map(&activtan);
-
-        lastLayer = layer;
-        allLayers[i] = lastLayer;
-    }
+    Matrix** allLayers = new Matrix*[m_hiddenLayers+1];
+    feedForward(inputMatrix, allLayers);
 
     // actual backpropagation part
-    Matrix error = targetMatrix - allLayers[m_hiddenLayers];
+    Matrix error = targetMatrix - *allLayers[m_hiddenLayers];
     for(int i = m_hiddenLayers; i >= 0; --i)
     {
-        // get the gradient - the derivative of the results of this layer
-        Matrix gradient = allLayers[i];
-        gradient.map(&derivtan);
-        // adjust based on the difference between the target and the result
-        gradient *= error;
-        // and adjust for our learning rate
-        gradient *= m_learningRate;
+        // outputs that weren't kept are fed forward again here, before the
+        //  sample starts, so the profiler only counts that as forward work
+        Matrix& output = getLayerOutput(i, inputMatrix, allLayers);
+        // previous layer
+        Matrix& pLayer = i == 0 ? inputMatrix
+                                : getLayerOutput(i-1, inputMatrix, allLayers);
 
-        // adjust bias with this value before calculating the weight delta
-        (*m_biases[i]) += gradient;
+        Profiler::Sample sample;
+        if(m_profiler)
+            sample = m_profiler->begin();
+
+        Matrix gradient = adjustBiases(i, output, error);
 
-        Matrix pLayer; // previous layer
-        if(i == 0)
-            pLayer = inputMatrix;
-        else
-            pLayer = allLayers[i-1];
         // transpose to get it in the correct layout to multiply
         Matrix pTrans = pLayer.transposed();
         // multiply the last layer's results by the gradient to get the
@@ -146,13 +318,675 @@ void NeuralNetwork::propagate(float const* inputs, float const* targets)
         // adjust the weights!
         (*m_weights[i]) += wDelta;
 
+        // the input layer has nothing before it to pass the error on to,
+        //  unless there are feature layers
+        if(i > 0 || m_featureLayerCount > 0)
+        {
+            Matrix weightTrans = m_weights[i]->transposed();
+            // base the next layer's error on this layer's error
+            error = weightTrans.product(error);
+        }
+
+        if(m_profiler)
+        {
+            long long flops, bytes;
+            backwardCost(m_weights[i]->getRows(), m_weights[i]->getColumns(),
+                         1, i > 0 || m_featureLayerCount > 0, &flops, &bytes);
+            m_profiler->end(sample, i, true, flops, bytes);
+        }
+
+        // nothing needs this layer's output anymore
+        releaseLayerOutput(i, allLayers);
+    }
+
+    // carry on backpropagating through the feature layers
+    for(int i = m_featureLayerCount-1; i >= 0; --i)
+    {
+        Profiler::Sample sample;
+        if(m_profiler)
+            sample = m_profiler->begin();
+
+        error = m_featureLayers[i]->backward(features[i], features[i+1],
+                                             error, m_learningRate);
+
+        if(m_profiler)
+        {
+            long long flops, bytes;
+            featureCost(m_featureLayers[i], true, &flops, &bytes);
+            m_profiler->endFeature(sample, i, true, flops, bytes);
+        }
+    }
+
+    delete[] allLayers;
+    delete[] features;
+
+    markWeightsChanged();
+}
+
+void NeuralNetwork::propagateSparse(int const* indices, float const* values,
+                                    int count, float const* targets)
+{
+    if(m_featureLayerCount > 0)
+    {
+        float* input = makeDenseInput(indices, values, count);
+        propagate(input, targets);
+        delete[] input;
+        return;
+    }
+
+    Matrix targetMatrix(m_outputNodes, 1);
+    for(int i = 0; i < m_outputNodes; ++i)
+        targetMatrix[i][0] = targets[i];
+
+    Matrix* allLayers = new Matrix[m_hiddenLayers+1];
+    allLayers[0] = feedSparseLayer(indices, values, count);
+    for(int i = 1; i < m_hiddenLayers+1; ++i)
+        allLayers[i] = feedLayer(i, allLayers[i-1]);
+
+    // same as propagate for every layer except the first
+    Matrix error = targetMatrix - allLayers[m_hiddenLayers];
+    for(int i = m_hiddenLayers; i > 0; --i)
+    {
+        Profiler::Sample sample;
+        if(m_profiler)
+            sample = m_profiler->begin();
+
+        Matrix gradient = adjustBiases(i, allLayers[i], error);
+
+        Matrix pTrans = allLayers[i-1].transposed();
+        Matrix wDelta = gradient.product(pTrans);
+        (*m_weights[i]) += wDelta;
+
         Matrix weightTrans = m_weights[i]->transposed();
-        Matrix m = error; // save this here to delete it after reassigning
-        // base the next layer's error on this layer's error
         error = weightTrans.product(error);
+
+        if(m_profiler)
+        {
+            long long flops, bytes;
+            backwardCost(m_weights[i]->getRows(), m_weights[i]->getColumns(),
+                         1, true, &flops, &bytes);
+            m_profiler->end(sample, i, true, flops, bytes);
+        }
     }
 
-	delete[] allLayers;
+    Profiler::Sample sample;
+    if(m_profiler)
+        sample = m_profiler->begin();
+
+    // the first layer's weight delta is zero for every input that's zero,
+    //  so only the columns of the nonzero inputs need adjusting
+    Matrix gradient = adjustBiases(0, allLayers[0], error);
+    Matrix& weights = *m_weights[0];
+    for(int n = 0; n < count; ++n)
+    {
+        int col = indices[n];
+        if(col < 0 || col >= m_inputNodes)
+            continue;
+
+        for(int r = 0; r < weights.getRows(); ++r)
+            weights[r][col] += gradient[r][0] * values[n];
+    }
+
+    if(m_profiler)
+    {
+        long long rows = weights.getRows();
+        m_profiler->end(sample, 0, true, 2*rows*count + 4*rows,
+                        4*(2*rows*count + 4*rows + 2*count));
+    }
+
+    delete[] allLayers;
+
+    markWeightsChanged();
+}
+
+void NeuralNetwork::computeGradients(float const* inputs,
+                                     float const* targets, int count,
+                                     Matrix* weightGrads, Matrix* biasGrads,
+                                     GradientCallback layerDone,
+                                     void* userData)
+{
+    if(count <= 0)
+        return;
+
+    // one column per sample, like guessBatch
+    int inputCount = getInputCount();
+    Matrix inputMatrix(m_inputNodes, count);
+    Matrix targetMatrix(m_outputNodes, count);
+    for(int s = 0; s < count; ++s)
+    {
+        Matrix column = prepareInput(inputs + s*inputCount, nullptr);
+        for(int i = 0; i < m_inputNodes; ++i)
+            inputMatrix[i][s] = column[i][0];
+        for(int i = 0; i < m_outputNodes; ++i)
+            targetMatrix[i][s] = targets[s*m_outputNodes + i];
+    }
+
+    Matrix** allLayers = new Matrix*[m_hiddenLayers+1];
+    feedForward(inputMatrix, allLayers);
+
+    Matrix error = targetMatrix - *allLayers[m_hiddenLayers];
+    for(int i = m_hiddenLayers; i >= 0; --i)
+    {
+        // recomputed outputs count as forward work, like in propagate
+        Matrix& output = getLayerOutput(i, inputMatrix, allLayers);
+        Matrix& pLayer = i == 0 ? inputMatrix
+                                : getLayerOutput(i-1, inputMatrix, allLayers);
+
+        Profiler::Sample sample;
+        if(m_profiler)
+            sample = m_profiler->begin();
+
+        Matrix gradient = layerGradient(i, output, error);
+
+        // the bias change is the gradient summed over every sample
+        Matrix biasGrad(gradient.getRows(), 1);
+        for(int y = 0; y < gradient.getRows(); ++y)
+        {
+            float sum = 0.0f;
+            for(int x = 0; x < count; ++x)
+                sum += gradient[y][x];
+            biasGrad[y][0] = sum;
+        }
+        biasGrads[i] = biasGrad;
+
+        // multiplying by the transposed batch sums over the samples too
+        Matrix pTrans = pLayer.transposed();
+        weightGrads[i] = gradient.product(pTrans);
+
+        // unlike propagate the weights haven't changed yet, so the error is
+        //  passed back through the weights that made the guess
+        if(i > 0)
+        {
+            Matrix weightTrans = m_weights[i]->transposed();
+            error = weightTrans.product(error);
+        }
+
+        if(m_profiler)
+        {
+            long long flops, bytes;
+            backwardCost(m_weights[i]->getRows(), m_weights[i]->getColumns(),
+                         count, i > 0, &flops, &bytes);
+            m_profiler->end(sample, i, true, flops, bytes);
+        }
+
+        releaseLayerOutput(i, allLayers);
+
+        if(layerDone)
+            layerDone(i, userData);
+    }
+
+    delete[] allLayers;
+}
+
+void NeuralNetwork::applyGradients(Matrix* weightGrads, Matrix* biasGrads,
+                                   float scale)
+{
+    for(int i = 0; i < m_hiddenLayers+1; ++i)
+    {
+        Matrix weightDelta = weightGrads[i] * scale;
+        (*m_weights[i]) += weightDelta;
+        Matrix biasDelta = biasGrads[i] * scale;
+        (*m_biases[i]) += biasDelta;
+    }
+
+    markWeightsChanged();
+}
+
+bool NeuralNetwork::addFeatureLayer(FeatureLayer* layer)
+{
+    return addFeatureLayers(&layer, 1);
+}
+
+bool NeuralNetwork::addFeatureLayers(FeatureLayer* const* layers, int count)
+{
+    // the normalizer was fit to the raw inputs, which would now be the
+    //  feature layers' outputs
+    if(m_normalizer || count <= 0)
+        return false;
+
+    // each layer has to fit onto the one before it
+    int size = m_featureLayerCount > 0
+               ? m_featureLayers[m_featureLayerCount-1]->getOutputSize() : -1;
+    for(int i = 0; i < count; ++i)
+    {
+        if(size >= 0 && layers[i]->getInputSize() != size)
+            return false;
+        size = layers[i]->getOutputSize();
+    }
+
+    // and the last one has to give the dense layers exactly what they take,
+    //  or guessing would read past the end of its output
+    if(size != m_inputNodes)
+        return false;
+
+    auto all = new FeatureLayer*[m_featureLayerCount+count];
+    for(int i = 0; i < m_featureLayerCount; ++i)
+        all[i] = m_featureLayers[i];
+    for(int i = 0; i < count; ++i)
+        all[m_featureLayerCount+i] = layers[i];
+
+    delete[] m_featureLayers;
+    m_featureLayers = all;
+    m_featureLayerCount += count;
+
+    markWeightsChanged();
+    return true;
+}
+
+int NeuralNetwork::getInputCount()
+{
+    if(m_featureLayerCount > 0)
+        return m_featureLayers[0]->getInputSize();
+    return m_inputNodes;
+}
+
+long long NeuralNetwork::getGuessFlops()
+{
+    long long total = 0;
+    for(int i = 0; i < m_featureLayerCount; ++i)
+        total += m_featureLayers[i]->getFlops();
+
+    for(int i = 0; i < m_hiddenLayers+1; ++i)
+    {
+        long long flops, bytes;
+        forwardCost(m_weights[i]->getRows(), m_weights[i]->getColumns(), 1,
+                    &flops, &bytes);
+        total += flops;
+    }
+    return total;
+}
+
+bool NeuralNetwork::setNormalizer(Normalizer const& normalizer)
+{
+    if(m_featureLayerCount > 0
+       || normalizer.getFeatureCount() != m_inputNodes)
+        return false;
+
+    bool packed = hasPackedWeights();
+
+    clearNormalizer();
+    m_normalizer = new Normalizer(normalizer);
+    foldNormalizer(false);
+    markWeightsChanged();
+
+    // keep guess on the fast path if it was on it
+    if(packed)
+        packWeights();
+    return true;
+}
+
+void NeuralNetwork::clearNormalizer()
+{
+    if(!m_normalizer)
+        return;
+
+    bool packed = hasPackedWeights();
+
+    foldNormalizer(true);
+    delete m_normalizer;
+    m_normalizer = nullptr;
+    markWeightsChanged();
+
+    if(packed)
+        packWeights();
+}
+
+void NeuralNetwork::foldNormalizer(bool unfold)
+{
+    // the first layer works out W*(x*scale+shift)+b, which is the same as
+    //  (W*scale)*x + (W*shift+b), so the rescaling can go in the weights
+    Matrix& weights = *m_weights[0];
+    Matrix& biases = *m_biases[0];
+    int cols = weights.getColumns();
+
+    for(int r = 0; r < weights.getRows(); ++r)
+    {
+        float* row = weights[r];
+        float shifted = 0.0f;
+        for(int c = 0; c < cols; ++c)
+        {
+            if(unfold)
+                row[c] /= m_normalizer->getScale(c);
+            shifted += row[c] * m_normalizer->getShift(c);
+            if(!unfold)
+                row[c] *= m_normalizer->getScale(c);
+        }
+        biases[r][0] += unfold ? -shifted : shifted;
+    }
+}
+
+Matrix NeuralNetwork::prepareInput(float const* input, Matrix* features)
+{
+    Matrix lastLayer(getInputCount(), 1);
+    for(int i = 0; i < lastLayer.getRows(); ++i)
+        lastLayer[i][0] = input[i];
+
+    if(features)
+        features[0] = lastLayer;
+
+    for(int i = 0; i < m_featureLayerCount; ++i)
+    {
+        Profiler::Sample sample;
+        if(m_profiler)
+            sample = m_profiler->begin();
+
+        lastLayer = m_featureLayers[i]->forward(lastLayer);
+
+        if(m_profiler)
+        {
+            long long flops, bytes;
+            featureCost(m_featureLayers[i], false, &flops, &bytes);
+            m_profiler->endFeature(sample, i, false, flops, bytes);
+        }
+        if(features)
+            features[i+1] = lastLayer;
+    }
+
+    return lastLayer;
+}
+
+float* NeuralNetwork::makeDenseInput(int const* indices, float const* values,
+                                     int count)
+{
+    int inputCount = getInputCount();
+    float* input = new float[inputCount];
+    for(int i = 0; i < inputCount; ++i)
+        input[i] = 0.0f;
+
+    for(int n = 0; n < count; ++n)
+        if(indices[n] >= 0 && indices[n] < inputCount)
+            input[indices[n]] += values[n];
+
+    return input;
+}
+
+void NeuralNetwork::setCheckpointInterval(int interval)
+{
+    m_checkpointInterval = interval < 1 ? 1 : interval;
+}
+
+void NeuralNetwork::feedForward(Matrix& input, Matrix** layers)
+{
+    m_activationBytes = 0;
+    m_peakActivationBytes = 0;
+
+    // only checkpoints are kept, along with the output layer which is
+    //  needed straight away
+    Matrix* last = &input;
+    Matrix* unkept = nullptr;
+    for(int i = 0; i < m_hiddenLayers+1; ++i)
+    {
+        auto layer = new Matrix(feedLayer(i, *last));
+        holdLayerOutput(layer);
+
+        if(i % m_checkpointInterval == 0 || i == m_hiddenLayers)
+            layers[i] = layer;
+        else
+            layers[i] = nullptr;
+
+        // the previous layer isn't needed once this one's worked out
+        if(unkept)
+        {
+            m_activationBytes -= 4LL * unkept->getRows() * unkept->getColumns();
+            delete unkept;
+        }
+        unkept = layers[i] ? nullptr : layer;
+        last = layer;
+    }
+}
+
+Matrix& NeuralNetwork::getLayerOutput(int layer, Matrix& input,
+                                      Matrix** layers)
+{
+    if(layers[layer])
+        return *layers[layer];
+
+    // go back to the closest layer that's still around and work forward
+    //  from it, keeping everything in between since backpropagation is
+    //  about to need those too
+    // the layers before the one being adjusted haven't been changed yet,
+    //  so this gives exactly what feeding forward gave
+    int start = layer;
+    while(start >= 0 && !layers[start])
+        --start;
+
+    for(int i = start+1; i <= layer; ++i)
+    {
+        Matrix& last = i == 0 ? input : *layers[i-1];
+        layers[i] = new Matrix(feedLayer(i, last));
+        holdLayerOutput(layers[i]);
+    }
+
+    return *layers[layer];
+}
+
+void NeuralNetwork::holdLayerOutput(Matrix* output)
+{
+    m_activationBytes += 4LL * output->getRows() * output->getColumns();
+    if(m_activationBytes > m_peakActivationBytes)
+        m_peakActivationBytes = m_activationBytes;
+}
+
+void NeuralNetwork::releaseLayerOutput(int layer, Matrix** layers)
+{
+    if(!layers[layer])
+        return;
+
+    m_activationBytes -= 4LL * layers[layer]->getRows()
+                         * layers[layer]->getColumns();
+    delete layers[layer];
+    layers[layer] = nullptr;
+}
+
+Matrix NeuralNetwork::feedLayer(int layer, Matrix& input)
+{
+    Matrix result(m_weights[layer]->getRows(), input.getColumns());
+    feedLayerInto(layer, input, result);
+    return result;
+}
+
+bool NeuralNetwork::feedLayerInto(int layer, Matrix& input, Matrix& output)
+{
+    // nothing sensible can come out if the input isn't from the layer before
+    if(input.getRows() != m_weights[layer]->getColumns()
+       || &input == &output)
+        return false;
+    // an output that's the wrong size would keep whatever was in it before,
+    //  so it's made again instead
+    int rows = m_weights[layer]->getRows();
+    if(output.getRows() != rows || output.getColumns() != input.getColumns())
+        output = Matrix(rows, input.getColumns());
+
+    Profiler::Sample sample;
+    if(m_profiler)
+        sample = m_profiler->begin();
+
+    // take the input to these neurons and multiply them by the weights
+    m_weights[layer]->productInto(input, output);
+    // add biases separately, could also just be another weight
+    output.addToColumns(*(m_biases[layer]));
+    // scale between -1 and 1 using activation function
+    activateLayer(layer, output);
+
+    if(m_profiler)
+    {
+        long long flops, bytes;
+        forwardCost(m_weights[layer]->getRows(),
+                    m_weights[layer]->getColumns(), input.getColumns(),
+                    &flops, &bytes);
+        m_profiler->end(sample, layer, false, flops, bytes);
+    }
+    return true;
+}
+
+Matrix NeuralNetwork::feedPackedLayer(int layer, Matrix& input)
+{
+    Profiler::Sample sample;
+    if(m_profiler)
+        sample = m_profiler->begin();
+
+    // a column matrix's values are contiguous, so its first row is the
+    //  whole column
+    Matrix result(m_packed[layer]->getRows(), 1);
+    m_packed[layer]->multiply(input[0], (*m_biases[layer])[0], result[0],
+                              m_guessThreads);
+    activateLayer(layer, result);
+
+    if(m_profiler)
+    {
+        long long flops, bytes;
+        forwardCost(m_packed[layer]->getRows(),
+                    m_packed[layer]->getColumns(), 1, &flops, &bytes);
+        m_profiler->end(sample, layer, false, flops, bytes);
+    }
+
+    return result;
+}
+
+void NeuralNetwork::packWeights()
+{
+    freePackedWeights();
+
+    m_packed = new PackedMatrix*[m_hiddenLayers+1];
+    for(int i = 0; i < m_hiddenLayers+1; ++i)
+        m_packed[i] = new PackedMatrix(*m_weights[i]);
+    m_packedVersion = m_weightVersion;
+}
+
+bool NeuralNetwork::hasPackedWeights()
+{
+    return m_packed && m_packedVersion == m_weightVersion;
+}
+
+void NeuralNetwork::markWeightsChanged()
+{
+    m_weightVersion = ++s_weightVersions;
+}
+
+void NeuralNetwork::setLoss(LossFunction loss)
+{
+    bool packed = hasPackedWeights();
+
+    m_loss = loss;
+
+    // guesses come out differently so anything cached is stale, but the
+    //  output activation is applied as the packed layers run so the packed
+    //  weights are still good
+    m_weightVersion = ++s_weightVersions;
+    if(packed)
+        m_packedVersion = m_weightVersion;
+}
+
+void NeuralNetwork::freePackedWeights()
+{
+    if(!m_packed)
+        return;
+
+    for(int i = 0; i < m_hiddenLayers+1; ++i)
+        delete m_packed[i];
+    delete[] m_packed;
+    m_packed = nullptr;
+}
+
+Matrix NeuralNetwork::feedSparseLayer(int const* indices, float const* values,
+                                      int count)
+{
+    Profiler::Sample sample;
+    if(m_profiler)
+        sample = m_profiler->begin();
+
+    Matrix& weights = *m_weights[0];
+    Matrix result = *m_biases[0];
+
+    // only gather the columns of the weights that have a nonzero input,
+    //  going row by row so each row is read in one go
+    for(int r = 0; r < weights.getRows(); ++r)
+    {
+        float* row = weights[r];
+        float sum = result[r][0];
+        for(int n = 0; n < count; ++n)
+        {
+            int col = indices[n];
+            if(col < 0 || col >= m_inputNodes)
+                continue;
+            sum += row[col] * values[n];
+        }
+        result[r][0] = sum;
+    }
+
+    activateLayer(0, result);
+
+    if(m_profiler)
+    {
+        long long rows = weights.getRows();
+        m_profiler->end(sample, 0, false, 2*rows*count + 2*rows,
+                        4*(rows*count + 2*rows + 2*count));
+    }
+
+    return result;
+}
+
+Matrix NeuralNetwork::adjustBiases(int layer, Matrix& output, Matrix& error)
+{
+    Matrix gradient = layerGradient(layer, output, error);
+
+    // adjust bias with this value before calculating the weight delta
+    (*m_biases[layer]) += gradient;
+
+    return gradient;
+}
+
+Matrix NeuralNetwork::layerGradient(int layer, Matrix& output, Matrix& error)
+{
+    // with cross entropy the derivative of the loss and of softmax/sigmoid
+    //  cancel out to just the error, so it's one pass with nothing that can
+    //  blow up
+    if(layer == m_hiddenLayers && m_loss != LOSS_MSE)
+        return error * m_learningRate;
+
+    // get the gradient - the derivative of the results of this layer
+    Matrix gradient = output;
+    gradient.map(&derivtan);
+    // adjust based on the difference between the target and the result
+    gradient *= error;
+    // and adjust for our learning rate
+    gradient *= m_learningRate;
+    return gradient;
+}
+
+void NeuralNetwork::activateLayer(int layer, Matrix& values)
+{
+    if(layer != m_hiddenLayers || m_loss == LOSS_MSE)
+    {
+        values.map(&activtan);
+        return;
+    }
+
+    if(m_loss == LOSS_SIGMOID_CROSS_ENTROPY)
+    {
+        values.map(&sigmoid);
+        return;
+    }
+
+    // softmax down each column, taking away the biggest value first so
+    //  expf can't overflow
+    for(int x = 0; x < values.getColumns(); ++x)
+    {
+        float biggest = values[0][x];
+        for(int y = 1; y < values.getRows(); ++y)
+            if(values[y][x] > biggest)
+                biggest = values[y][x];
+
+        float sum = 0.0f;
+        for(int y = 0; y < values.getRows(); ++y)
+        {
+            values[y][x] = expf(values[y][x] - biggest);
+            sum += values[y][x];
+        }
+
+        for(int y = 0; y < values.getRows(); ++y)
+            values[y][x] /= sum;
+    }
 }
 
 bool NeuralNetwork::save(const char* filename)
@@ -173,6 +1007,24 @@ bool NeuralNetwork::save(const char* filename)
      * 4 bytes - number of matrices (hidden layers+1)
      * however many bytes - all weights
      * however many bytes - all biases
+     *
+     * then any number of optional sections, which loading skips if it
+     *  doesn't know about them:
+     * 4 bytes - section id
+     * 4 bytes - size of the section in bytes
+     * however many bytes - section data
+     *
+     * NN_SECTION_FEATURES - feature layers in front of the dense layers,
+     *  input nodes above is then the size of the last feature layer's output
+     * 4 bytes - number of feature layers
+     * however many bytes - each layer, see FeatureLayer::save
+     *
+     * NN_SECTION_LOSS - loss function, LOSS_MSE if there isn't one
+     * 4 bytes - the LossFunction
+     *
+     * NN_SECTION_NORMALIZER - input normalization, already folded into the
+     *  first layer's weights above
+     * however many bytes - see Normalizer::save
      */
     std::fstream file;
     file.open(filename, std::ios::out | std::ios::binary);
@@ -205,47 +1057,50 @@ bool NeuralNetwork::save(const char* filename)
     int matrixCount = m_hiddenLayers+1;
     file.write((char*)&matrixCount, 4);
 
-    // write weight matrices
+    // write weight matrices, each matrix's rows are one block in memory in
+    //  the same order they go in the file so it's a single write
     for(int i = 0; i < matrixCount; ++i)
     {
         Matrix* m = m_weights[i];
-
-        int rows = m->getRows();
-        int cols = m->getColumns();
-
-        // write the actual values
-        for(int y = 0; y < rows; ++y)
-        {
-            for(int x = 0; x < cols; ++x)
-            {
-                float val = (*m)[y][x];
-
-                file.write((char*)&val, 4);
-            }
-        }
+        file.write((char*)(*m)[0], (long long)m->getRows() * m->getColumns()
+                                   * sizeof(float));
     }
 
     // write bias matrices
     for(int i = 0; i < matrixCount; ++i)
     {
         Matrix* m = m_biases[i];
+        file.write((char*)(*m)[0], (long long)m->getRows() * m->getColumns()
+                                   * sizeof(float));
+    }
 
-        int rows = m->getRows();
-        int cols = m->getColumns();
+    if(m_featureLayerCount > 0)
+    {
+        int sizePos = beginSection(file, NN_SECTION_FEATURES);
+        file.write((char*)&m_featureLayerCount, 4);
+        for(int i = 0; i < m_featureLayerCount; ++i)
+            m_featureLayers[i]->save(file);
+        endSection(file, sizePos);
+    }
 
-        // write the actual values
-        for(int y = 0; y < rows; ++y)
-        {
-            for(int x = 0; x < cols; ++x)
-            {
-                float val = (*m)[y][x];
+    if(m_loss != LOSS_MSE)
+    {
+        int sizePos = beginSection(file, NN_SECTION_LOSS);
+        int loss = (int)m_loss;
+        file.write((char*)&loss, 4);
+        endSection(file, sizePos);
+    }
 
-                file.write((char*)&val, 4);
-            }
-        }
+    if(m_normalizer)
+    {
+        int sizePos = beginSection(file, NN_SECTION_NORMALIZER);
+        m_normalizer->save(file);
+        endSection(file, sizePos);
     }
 
-    return true;
+    // closing flushes what's left, so a full disk shows up here
+    file.close();
+    return !file.fail();
 }
 
 NeuralNetwork* NeuralNetwork::load(const char* filename)
@@ -301,60 +1156,124 @@ NeuralNetwork* NeuralNetwork::load(const char* filename)
     int matrixCount;
     file.read((char*)&matrixCount, 4);
 
-    // read weight matrices
+    // read weight matrices, a whole matrix at a time like save writes them
     for(int i = 0; i < matrixCount; ++i)
     {
         // why can I access this private member???
         Matrix* m = result->m_weights[i];
-
-        int rows = m->getRows();
-        int cols = m->getColumns();
-
-        for(int y = 0; y < rows; ++y)
-        {
-            for(int x = 0; x < cols; ++x)
-            {
-                float val;
-                file.read((char*)&val, 4);
-
-                printf("%.2f, ", val);
-
-                (*m)[y][x] = val;
-            }
-            printf("\n");
-        }
-        printf("\n");
+        file.read((char*)(*m)[0], (long long)m->getRows() * m->getColumns()
+                                  * sizeof(float));
     }
 
     // read bias matrices
     for(int i = 0; i < matrixCount; ++i)
     {
         Matrix* m = result->m_biases[i];
+        file.read((char*)(*m)[0], (long long)m->getRows() * m->getColumns()
+                                  * sizeof(float));
+    }
 
-        int rows = m->getRows();
-        int cols = m->getColumns();
+    // optional sections until the end of the file
+    while(true)
+    {
+        int section;
+        int size;
+        file.read((char*)&section, 4);
+        file.read((char*)&size, 4);
+        if(!file)
+            break;
 
-        for(int y = 0; y < rows; ++y)
+        std::streampos end = file.tellg() + (std::streamoff)size;
+
+        if(section == NN_SECTION_FEATURES)
         {
-            for(int x = 0; x < cols; ++x)
+            int count;
+            file.read((char*)&count, 4);
+
+            // read the whole chain first, it's only added if it ends at the
+            //  dense layers' inputs
+            std::vector<FeatureLayer*> layers;
+            bool ok = count >= 0;
+            for(int i = 0; ok && i < count; ++i)
+            {
+                FeatureLayer* layer = FeatureLayer::load(file);
+                if(layer)
+                    layers.push_back(layer);
+                ok = layer != nullptr;
+            }
+
+            if(!ok
+               || (count > 0 && !result->addFeatureLayers(layers.data(),
+                                                          count)))
             {
-                float val;
-                file.read((char*)&val, 4);
+                for(FeatureLayer* layer : layers)
+                    delete layer;
+                delete result;
+                return nullptr;
+            }
+        }
+
+        if(section == NN_SECTION_LOSS)
+        {
+            int loss;
+            file.read((char*)&loss, 4);
+            if(loss >= LOSS_MSE && loss <= LOSS_SIGMOID_CROSS_ENTROPY)
+                result->setLoss((LossFunction)loss);
+        }
 
-                (*m)[y][x] = val;
+        if(section == NN_SECTION_NORMALIZER)
+        {
+            // the weights were saved with it folded in, so it's only kept
+            //  to be saved again or taken out
+            auto normalizer = new Normalizer;
+            if(normalizer->load(file)
+               && normalizer->getFeatureCount() == result->m_inputNodes)
+            {
+                delete result->m_normalizer;
+                result->m_normalizer = normalizer;
+            }
+            else
+            {
+                delete normalizer;
             }
         }
+
+        // skip whatever's left, including sections we don't know about
+        file.seekg(end);
     }
 
     return result;
 }
 
+int NeuralNetwork::beginSection(std::fstream& file, int section)
+{
+    file.write((char*)&section, 4);
+
+    // the size isn't known until the section's written, so leave space
+    int sizePos = (int)file.tellp();
+    int size = 0;
+    file.write((char*)&size, 4);
+    return sizePos;
+}
+
+void NeuralNetwork::endSection(std::fstream& file, int sizePos)
+{
+    int end = (int)file.tellp();
+    int size = end - (sizePos + 4);
+
+    file.seekp(sizePos);
+    file.write((char*)&size, 4);
+    file.seekp(end);
+}
+
 NeuralNetwork* NeuralNetwork::copy()
 {
     auto result = new NeuralNetwork(m_inputNodes, m_hiddenLayers,
                                     m_hiddenNodeCount, m_outputNodes);
 
     result->setLearningRate(this->getLearningRate());
+    result->setCheckpointInterval(m_checkpointInterval);
+    result->setLoss(m_loss);
 
     // copy matrices
     for(int i = 0; i < m_hiddenLayers+1; ++i)
@@ -362,9 +1281,25 @@ NeuralNetwork* NeuralNetwork::copy()
         delete result->m_weights[i];
         result->m_weights[i] = new Matrix(*m_weights[i]);
         delete result->m_biases[i];
-        result->m_biases[i] = new Matrix(*m_weights[i]);
+        result->m_biases[i] = new Matrix(*m_biases[i]);
     }
 
+    if(m_featureLayerCount > 0)
+    {
+        std::vector<FeatureLayer*> layers;
+        for(int i = 0; i < m_featureLayerCount; ++i)
+            layers.push_back(m_featureLayers[i]->copy());
+        result->addFeatureLayers(layers.data(), m_featureLayerCount);
+    }
+
+    // the copied weights already have the normalizer folded in
+    if(m_normalizer)
+        result->m_normalizer = new Normalizer(*m_normalizer);
+
+    result->setGuessThreads(m_guessThreads);
+    if(hasPackedWeights())
+        result->packWeights();
+
     return result;
 }
 
@@ -375,6 +1310,8 @@ void NeuralNetwork::mutate(float rate)
         m_weights[i]->mutate(rate);
         m_biases[i]->mutate(rate);
     }
+
+    markWeightsChanged();
 }
 
 void NeuralNetwork::breed(NeuralNetwork* other)
@@ -384,8 +1321,242 @@ void NeuralNetwork::breed(NeuralNetwork* other)
     }
 }
 
+PruneReport NeuralNetwork::prune(float fraction, PruneMetric metric,
+                                 float const* inputs, float const* targets,
+                                 int count)
+{
+    // removing neurons throws away the packed weights, remember whether
+    //  there were any so both timings use the same guess path
+    bool packed = hasPackedWeights();
+
+    PruneReport report;
+    report.paramsBefore = getParameterCount();
+    report.errorBefore = 0.0f;
+    report.guessTimeBefore = 0.0f;
+    if(inputs && targets && count > 0)
+        report.errorBefore = meanSquaredError(inputs, targets, count);
+    if(inputs && count > 0)
+        report.guessTimeBefore = timeGuess(inputs, count);
+
+    // score each hidden neuron by the size of the weights leaving it
+    // the next layer's weights have a column for each neuron in this layer
+    float** scores = new float*[m_hiddenLayers];
+    for(int i = 0; i < m_hiddenLayers; ++i)
+    {
+        Matrix* next = m_weights[i+1];
+        scores[i] = new float[m_hiddenNodeCount[i]];
+        for(int n = 0; n < m_hiddenNodeCount[i]; ++n)
+        {
+            float sum = 0.0f;
+            for(int r = 0; r < next->getRows(); ++r)
+                sum += (*next)[r][n] * (*next)[r][n];
+            scores[i][n] = sqrtf(sum);
+        }
+    }
+
+    if(metric == PRUNE_ACTIVATION && inputs && count > 0)
+    {
+        // a neuron that barely activates doesn't matter much no matter
+        //  how big its weights are, so scale by how active it is
+        float** activity = new float*[m_hiddenLayers];
+        for(int i = 0; i < m_hiddenLayers; ++i)
+        {
+            activity[i] = new float[m_hiddenNodeCount[i]];
+            for(int n = 0; n < m_hiddenNodeCount[i]; ++n)
+                activity[i][n] = 0.0f;
+        }
+
+        for(int s = 0; s < count; ++s)
+        {
+            Matrix lastLayer = prepareInput(inputs + s*getInputCount(),
+                                            nullptr);
+
+            // only the hidden layers matter here
+            for(int i = 0; i < m_hiddenLayers; ++i)
+            {
+                auto layer = m_weights[i]->product(lastLayer);
+                layer += *(m_biases[i]);
+                layer.map(&activtan);
+
+                for(int n = 0; n < m_hiddenNodeCount[i]; ++n)
+                    activity[i][n] += absf(layer[n][0]);
+
+                lastLayer = layer;
+            }
+        }
+
+        for(int i = 0; i < m_hiddenLayers; ++i)
+        {
+            for(int n = 0; n < m_hiddenNodeCount[i]; ++n)
+                scores[i][n] *= activity[i][n] / count;
+            delete[] activity[i];
+        }
+        delete[] activity;
+    }
+
+    for(int i = 0; i < m_hiddenLayers; ++i)
+    {
+        int nodes = m_hiddenNodeCount[i];
+        int removeCount = (int)(nodes * fraction);
+        if(removeCount >= nodes)
+            removeCount = nodes - 1;
+
+        if(removeCount > 0)
+        {
+            // sort neuron indices from least to most useful
+            int* order = new int[nodes];
+            for(int n = 0; n < nodes; ++n)
+                order[n] = n;
+            float* layerScores = scores[i];
+            std::sort(order, order + nodes, [layerScores](int a, int b)
+            {
+                return layerScores[a] < layerScores[b];
+            });
+
+            bool* keep = new bool[nodes];
+            for(int n = 0; n < nodes; ++n)
+                keep[n] = true;
+            for(int n = 0; n < removeCount; ++n)
+                keep[order[n]] = false;
+
+            removeNeurons(i, keep);
+
+            delete[] keep;
+            delete[] order;
+        }
+
+        delete[] scores[i];
+    }
+    delete[] scores;
+
+    if(packed)
+        packWeights();
+
+    report.paramsAfter = getParameterCount();
+    report.errorAfter = 0.0f;
+    report.guessTimeAfter = 0.0f;
+    if(inputs && targets && count > 0)
+        report.errorAfter = meanSquaredError(inputs, targets, count);
+    if(inputs && count > 0)
+        report.guessTimeAfter = timeGuess(inputs, count);
+
+    return report;
+}
+
+bool NeuralNetwork::removeNeurons(int layer, bool const* keep)
+{
+    if(layer < 0 || layer >= m_hiddenLayers)
+        return false;
+
+    int oldCount = m_hiddenNodeCount[layer];
+    int newCount = 0;
+    for(int n = 0; n < oldCount; ++n)
+        if(keep[n])
+            ++newCount;
+
+    // nothing to remove, or removing everything which would disconnect
+    //  the network
+    if(newCount == oldCount || newCount == 0)
+        return false;
+
+    // neurons are rows in this layer's weights and biases, and columns in
+    //  the next layer's weights
+    Matrix* weights = m_weights[layer];
+    Matrix* biases = m_biases[layer];
+    Matrix* next = m_weights[layer+1];
+
+    int inCount = weights->getColumns();
+    int outCount = next->getRows();
+
+    auto newWeights = new Matrix(newCount, inCount);
+    auto newBiases = new Matrix(newCount, 1);
+    auto newNext = new Matrix(outCount, newCount);
+
+    int kept = 0;
+    for(int n = 0; n < oldCount; ++n)
+    {
+        if(!keep[n])
+            continue;
+
+        for(int x = 0; x < inCount; ++x)
+            (*newWeights)[kept][x] = (*weights)[n][x];
+        (*newBiases)[kept][0] = (*biases)[n][0];
+        for(int y = 0; y < outCount; ++y)
+            (*newNext)[y][kept] = (*next)[y][n];
+
+        ++kept;
+    }
+
+    delete weights;
+    delete biases;
+    delete next;
+    m_weights[layer] = newWeights;
+    m_biases[layer] = newBiases;
+    m_weights[layer+1] = newNext;
+
+    m_hiddenNodeCount[layer] = newCount;
+
+    markWeightsChanged();
+    return true;
+}
+
+float NeuralNetwork::meanSquaredError(float const* inputs,
+                                      float const* targets, int count)
+{
+    if(count <= 0)
+        return 0.0f;
+
+    float* output = new float[m_outputNodes];
+    float sum = 0.0f;
+    for(int s = 0; s < count; ++s)
+    {
+        guess(inputs + s*getInputCount(), output);
+        for(int i = 0; i < m_outputNodes; ++i)
+        {
+            float diff = targets[s*m_outputNodes + i] - output[i];
+            sum += diff * diff;
+        }
+    }
+    delete[] output;
+
+    return sum / (count * m_outputNodes);
+}
+
+float NeuralNetwork::timeGuess(float const* inputs, int count)
+{
+    if(count <= 0)
+        return 0.0f;
+
+    float* output = new float[m_outputNodes];
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for(int s = 0; s < count; ++s)
+        guess(inputs + s*getInputCount(), output);
+    auto end = std::chrono::high_resolution_clock::now();
+
+    delete[] output;
+
+    std::chrono::duration<float, std::micro> taken = end - start;
+    return taken.count() / count;
+}
+
+int NeuralNetwork::getParameterCount()
+{
+    int total = 0;
+    for(int i = 0; i < m_hiddenLayers+1; ++i)
+    {
+        total += m_weights[i]->getRows() * m_weights[i]->getColumns();
+        total += m_biases[i]->getRows();
+    }
+    return total;
+}
+
 float sigmoid(float x)
 {
+    // only ever take exp of a negative number so it can't overflow
+    if(x >= 0)
+        return 1 / (1 + expf(-x));
+
     float ex = expf(x);
     return ex / (ex + 1);
 }
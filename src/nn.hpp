@@ -3,7 +3,18 @@
 #define NN_FILE_ID_SIZE 8
 #define NN_FILE_ID { 'b', 'a', 'd', 'm', 'l', 'p', 'n', 'n' }
 
+// ids of the optional sections at the end of a saved network
+#define NN_SECTION_FEATURES 1
+#define NN_SECTION_LOSS 2
+#define NN_SECTION_NORMALIZER 3
+
+#include <fstream>
+
 class Matrix;
+class FeatureLayer;
+class Profiler;
+class PackedMatrix;
+class Normalizer;
 
 /***
  * @brief Sigmoid function used to 'normalize' the outputs of each neuron
@@ -32,6 +43,85 @@ float activtan(float x);
  */
 float derivtan(float x);
 
+/***
+ * @brief What the output layer does and how its error is measured
+ */
+enum LossFunction
+{
+    // tanh outputs and squared error, the original behaviour
+    LOSS_MSE,
+    // softmax outputs and cross entropy, for picking one class out of many,
+    //  targets should be 1 for the right class and 0 for the rest
+    LOSS_SOFTMAX_CROSS_ENTROPY,
+    // sigmoid outputs and binary cross entropy, for several yes/no labels
+    //  at once, targets should be 0 or 1
+    LOSS_SIGMOID_CROSS_ENTROPY
+};
+
+/***
+ * @brief Ways of scoring hidden neurons when deciding which ones to prune
+ */
+enum PruneMetric
+{
+    // size (L2 norm) of the weights going out of each neuron
+    PRUNE_WEIGHT_NORM,
+    // average absolute activation over a calibration set, scaled by the
+    //  size of the outgoing weights
+    PRUNE_ACTIVATION
+};
+
+/***
+ * @brief Before/after numbers from NeuralNetwork::prune so you can see what
+ *          was traded for the smaller network
+ */
+struct PruneReport
+{
+    int paramsBefore;
+    int paramsAfter;
+
+    // mean squared error over the calibration set (0 if there wasn't one)
+    float errorBefore;
+    float errorAfter;
+
+    // average time taken by one guess, in microseconds
+    float guessTimeBefore;
+    float guessTimeAfter;
+};
+
+// called by NeuralNetwork::computeGradients as each layer's gradients are done
+typedef void(*GradientCallback)(int layer, void* userData);
+
+/***
+ * @brief Matrices for NeuralNetwork::guessBatch to keep between calls, so
+ *          batches of the same size don't allocate anything
+ *          Each thread needs its own
+ */
+class GuessWorkspace
+{
+public:
+    GuessWorkspace();
+    ~GuessWorkspace();
+
+    GuessWorkspace(GuessWorkspace const&) = delete;
+    GuessWorkspace& operator=(GuessWorkspace const&) = delete;
+
+private:
+    friend class NeuralNetwork;
+
+    /***
+     * @brief Makes sure there are enough matrices, and that one is the
+     *          right size
+     * @param count Number of matrices needed
+     * @param index Index of the matrix to size
+     * @return The matrix, rows*cols
+     */
+    Matrix& get(int count, int index, int rows, int cols);
+
+    // the input columns, then each layer's output
+    Matrix** m_layers;
+    int m_layerCount;
+};
+
 class NeuralNetwork {
 public:
     /***
@@ -52,6 +142,37 @@ public:
      */
     void guess(float const* input, float* output);
 
+    /***
+     * @brief Guesses a batch of inputs at once, which is faster than calling
+     *          guess for each of them
+     *          Only reads the network, so it's safe to call from several
+     *          threads as long as nothing is training it at the same time
+     * @param inputs count*inputs floats, one sample after another
+     * @param outputs Array of count*outputs floats to put the results in
+     * @param count Number of samples
+     */
+    void guessBatch(float const* inputs, float* outputs, int count);
+    /***
+     * @brief Same as guessBatch but keeps its matrices in a workspace, so
+     *          once it's been used for a batch of this size it runs without
+     *          allocating anything (feature layers still allocate)
+     * @param workspace This thread's workspace
+     */
+    void guessBatch(float const* inputs, float* outputs, int count,
+                    GuessWorkspace& workspace);
+
+    /***
+     * @brief Same as guess but takes only the nonzero inputs, so the first
+     *          layer costs as much as the number of nonzeros instead of the
+     *          number of inputs
+     * @param indices Indices of the nonzero inputs
+     * @param values Values of the nonzero inputs
+     * @param count Number of nonzero inputs
+     * @param output Array to put the outputs in
+     */
+    void guessSparse(int const* indices, float const* values, int count,
+                     float* output);
+
     /***
      * @brief Takes a single set of inputs and targets and uses these to
      *          adjust weights in order to "learn"
@@ -60,6 +181,44 @@ public:
      */
     void propagate(float const* inputs, float const* targets);
 
+    /***
+     * @brief Same as propagate but with sparse inputs like guessSparse,
+     *          only the first layer weights of the nonzero inputs are touched
+     * @param indices Indices of the nonzero inputs
+     * @param values Values of the nonzero inputs
+     * @param count Number of nonzero inputs
+     * @param targets Desired output from inputs
+     */
+    void propagateSparse(int const* indices, float const* values, int count,
+                         float const* targets);
+
+    /***
+     * @brief Works out how a batch of samples wants to change the weights
+     *          and biases without actually changing them, so the changes
+     *          can be combined with other ones before applyGradients
+     *          Uses the same error calculation as propagate
+     * @param inputs count*inputs floats
+     * @param targets count*outputs floats
+     * @param count Number of samples
+     * @param weightGrads Array of getLayerCount() matrices to put the weight
+     *          changes in, summed over the batch and scaled by the learning
+     *          rate
+     * @param biasGrads Array of getLayerCount() matrices for the bias changes
+     * @param layerDone Called as soon as a layer's changes are finished,
+     *          starting from the output layer (can be nullptr)
+     * @param userData Passed to layerDone as is
+     */
+    void computeGradients(float const* inputs, float const* targets,
+                          int count, Matrix* weightGrads, Matrix* biasGrads,
+                          GradientCallback layerDone, void* userData);
+    /***
+     * @brief Adds changes from computeGradients to the weights and biases
+     * @param weightGrads Weight changes for each layer
+     * @param biasGrads Bias changes for each layer
+     * @param scale Multiplier for the changes, usually 1/number of samples
+     */
+    void applyGradients(Matrix* weightGrads, Matrix* biasGrads, float scale);
+
     // stuff for neuroevolution
     // not finished
     NeuralNetwork* copy();
@@ -67,6 +226,55 @@ public:
     // not implemented at all
     void breed(NeuralNetwork* other);
 
+    /***
+     * @brief Removes the least useful neurons from every hidden layer,
+     *          which actually shrinks the weight and bias matrices so the
+     *          result is just a smaller normal network
+     * @param fraction How much of each hidden layer to remove (0-1), every
+     *          layer always keeps at least one neuron
+     * @param metric How to decide which neurons are least useful
+     * @param inputs Calibration inputs, count*inputs floats (can be nullptr
+     *          when using PRUNE_WEIGHT_NORM)
+     * @param targets Calibration targets, count*outputs floats, only used
+     *          for the report (can be nullptr)
+     * @param count Number of calibration samples
+     * @return Size, error and speed of the network before and after pruning
+     */
+    PruneReport prune(float fraction, PruneMetric metric,
+                      float const* inputs, float const* targets, int count);
+
+    /***
+     * @brief Removes neurons from a single hidden layer
+     * @param layer Index of the hidden layer
+     * @param keep Array with one entry per neuron in the layer, neurons
+     *          with false are removed
+     * @return Whether or not anything was removed
+     */
+    bool removeNeurons(int layer, bool const* keep);
+
+    /***
+     * @brief Gets the mean squared error of this network over a data set
+     * @param inputs count*inputs floats
+     * @param targets count*outputs floats
+     * @param count Number of samples
+     * @return The mean squared error
+     */
+    float meanSquaredError(float const* inputs, float const* targets,
+                           int count);
+
+    /***
+     * @brief Times how long a guess takes on average
+     * @param inputs count*inputs floats to guess with
+     * @param count Number of samples
+     * @return Average time of one guess in microseconds
+     */
+    float timeGuess(float const* inputs, int count);
+
+    /***
+     * @return Total number of weights and biases in the network
+     */
+    int getParameterCount();
+
     /***
      * @brief Saves this network to a file
      * @param filename File to save to
@@ -80,11 +288,267 @@ public:
      */
     static NeuralNetwork* load(const char* filename);
 
+    /***
+     * @brief Attaches a profiler which records the time and work spent in
+     *          each layer while guessing and propagating
+     * @param profiler Profiler to record into, or nullptr to stop profiling
+     */
+    void setProfiler(Profiler* profiler) { m_profiler = profiler; }
+    Profiler* getProfiler() { return m_profiler; }
+
+    /***
+     * @return Number of inputs the network takes, which is the first feature
+     *          layer's input size if there are feature layers
+     */
+    int getInputCount();
+    int getOutputCount() { return m_outputNodes; }
+
+    /***
+     * @brief Adds a layer (like a ConvLayer or PoolLayer) in front of the
+     *          dense layers, after any feature layers already added
+     *          Its output size has to be the number of inputs the network
+     *          was made with, use addFeatureLayers for a chain of layers
+     *          computeGradients and the sparse functions only feed inputs
+     *          through feature layers, only propagate trains them
+     * @param layer The layer, which the network now owns if it was added
+     * @return Whether or not it was added, false if it doesn't fit onto the
+     *          previous feature layer or the dense layers, or the network
+     *          has a normalizer
+     */
+    bool addFeatureLayer(FeatureLayer* layer);
+    /***
+     * @brief Adds a chain of layers in front of the dense layers, after any
+     *          feature layers already added, either all of them or none
+     *          Each layer has to fit onto the one before it and the last
+     *          one's output size has to be the number of inputs the network
+     *          was made with
+     * @param layers The layers in the order inputs go through them, which
+     *          the network now owns if they were added
+     * @param count Number of layers
+     * @return Whether or not they were added
+     */
+    bool addFeatureLayers(FeatureLayer* const* layers, int count);
+    int getFeatureLayerCount() { return m_featureLayerCount; }
+    FeatureLayer* getFeatureLayer(int index) { return m_featureLayers[index]; }
+
+    /***
+     * @return Floating point operations done by one guess
+     */
+    long long getGuessFlops();
+
+    /***
+     * @return Number of weight/bias matrices, hidden layers+1
+     */
+    int getLayerCount() { return m_hiddenLayers+1; }
+    /***
+     * @param layer Index of the layer
+     * @return The layer's weight matrix
+     */
+    Matrix* getWeights(int layer) { return m_weights[layer]; }
+    /***
+     * @param layer Index of the layer
+     * @return The layer's bias matrix
+     */
+    Matrix* getBiases(int layer) { return m_biases[layer]; }
+
+    /***
+     * @brief Copies the weights into the panel layout used by PackedMatrix,
+     *          after which guess multiplies by them instead of going through
+     *          Matrix::product, which is much quicker for a single column
+     *          The packed copy takes as much memory again as the weights and
+     *          only guess uses it, so nothing packs on its own (not even
+     *          load). It has to be done again once the weights change
+     *          (training, mutating...) or guess goes back to the slower
+     *          path
+     */
+    void packWeights();
+    /***
+     * @return Whether guess is using packed weights right now
+     */
+    bool hasPackedWeights();
+    /***
+     * @brief Lets guess split the rows of big layers between threads, which
+     *          brings down the latency of one guess when there are spare
+     *          cores, only used with packed weights
+     * @param threads Most threads to use for one layer, 1 never splits
+     */
+    void setGuessThreads(int threads) { m_guessThreads = threads; }
+    int getGuessThreads() { return m_guessThreads; }
+    /***
+     * @return A number that changes whenever anything that changes guesses
+     *          does, and is never the same for two different networks
+     */
+    long long getWeightVersion() { return m_weightVersion; }
+    /***
+     * @brief Tells the network its weights were changed from outside, like
+     *          through getWeights, so it stops using packed weights
+     */
+    void markWeightsChanged();
+
+    /***
+     * @brief Saves memory while training deep networks by only keeping
+     *          every interval-th layer's output when feeding forward in
+     *          propagate and computeGradients, the others are worked out
+     *          again when backpropagation gets to them
+     *          Memory goes down to about layers/interval+interval outputs
+     *          for up to one extra feed forward, sqrt(layers) is a good
+     *          middle ground
+     * @param interval How often to keep a layer's output, 1 keeps them all
+     */
+    void setCheckpointInterval(int interval);
+    int getCheckpointInterval() { return m_checkpointInterval; }
+    /***
+     * @return Most bytes of layer outputs held at once during the last
+     *          propagate or computeGradients
+     */
+    long long getPeakActivationBytes() { return m_peakActivationBytes; }
+
+    /***
+     * @brief Folds input normalization into the first layer's weights and
+     *          biases, so guess takes raw features from then on and the
+     *          normalizing costs nothing
+     *          The normalizer is saved with the network, the saved weights
+     *          already have it folded in so the file works anywhere
+     *          Training afterwards carries on with raw features
+     * @param normalizer Normalizer with one feature per input, replaces any
+     *          set before
+     * @return Whether it was set, false if the number of features doesn't
+     *          match or the network has feature layers
+     */
+    bool setNormalizer(Normalizer const& normalizer);
+    /***
+     * @brief Takes the normalization back out of the first layer, so guess
+     *          expects normalized inputs again
+     */
+    void clearNormalizer();
+    /***
+     * @return The normalizer folded into the network, nullptr if none
+     */
+    Normalizer const* getNormalizer() { return m_normalizer; }
+
+    /***
+     * @brief Picks what the output layer does, saved with the network
+     * @param loss Loss function to train with
+     */
+    void setLoss(LossFunction loss);
+    LossFunction getLoss() { return m_loss; }
+
     // learning rate getter/setter
     float getLearningRate() { return m_learningRate; }
     void setLearningRate(float rate) { m_learningRate = rate; }
 
 private:
+    // runs the layers itself, a few at a time on separate threads
+    friend class PipelineTrainer;
+
+    /***
+     * @brief Runs one layer of the network
+     * @param layer Index of the weight/bias matrices to use
+     * @param input Output of the previous layer
+     * @return Output of this layer
+     */
+    Matrix feedLayer(int layer, Matrix& input);
+    /***
+     * @brief Same as feedLayer but writes into an existing matrix
+     * @param output Matrix for the layer's output, made again if it isn't
+     *          already the right size
+     * @return False if the input doesn't fit the layer, in which case the
+     *          output is left alone
+     */
+    bool feedLayerInto(int layer, Matrix& input, Matrix& output);
+    /***
+     * @brief Runs one layer for a single column using the packed weights
+     * @param layer Index of the weight/bias matrices to use
+     * @param input Output of the previous layer, one column
+     * @return Output of this layer
+     */
+    Matrix feedPackedLayer(int layer, Matrix& input);
+    /***
+     * @brief Deletes the packed weights, if there are any
+     */
+    void freePackedWeights();
+    /***
+     * @brief Feeds forward through every dense layer, keeping the outputs
+     *          of the layers picked by the checkpoint interval
+     * @param input Input to the first dense layer
+     * @param layers Array of hidden layers+1 pointers to fill, layers that
+     *          weren't kept are nullptr
+     */
+    void feedForward(Matrix& input, Matrix** layers);
+    /***
+     * @brief Gets a layer output from feedForward, working it out again
+     *          from the closest kept layer if it wasn't kept
+     * @param layer Index of the layer
+     * @param input Input to the first dense layer
+     * @param layers Layer outputs from feedForward
+     * @return The layer's output
+     */
+    Matrix& getLayerOutput(int layer, Matrix& input, Matrix** layers);
+    /***
+     * @brief Counts a new layer output towards the activation memory
+     */
+    void holdLayerOutput(Matrix* output);
+    /***
+     * @brief Deletes a layer output from feedForward once it's not needed
+     */
+    void releaseLayerOutput(int layer, Matrix** layers);
+    /***
+     * @brief Runs the first layer of the network with sparse inputs
+     * @return Output of the first layer
+     */
+    Matrix feedSparseLayer(int const* indices, float const* values, int count);
+    /***
+     * @brief Works out a layer's gradient from its output and error, and
+     *          adjusts the layer's biases with it
+     * @param layer Index of the layer
+     * @param output Output of the layer from feeding forward
+     * @param error Error of the layer's output
+     * @return The gradient, already scaled by the learning rate
+     */
+    Matrix adjustBiases(int layer, Matrix& output, Matrix& error);
+    /***
+     * @brief Works out a layer's gradient from its output and error
+     * @return The gradient, already scaled by the learning rate
+     */
+    Matrix layerGradient(int layer, Matrix& output, Matrix& error);
+    /***
+     * @brief Applies a layer's activation function, tanh for hidden layers
+     *          and whatever the loss function needs for the output layer
+     * @param layer Index of the layer
+     * @param values Layer's values before activation, changed in place
+     */
+    void activateLayer(int layer, Matrix& values);
+    /***
+     * @brief Makes a column matrix from some inputs and runs it through the
+     *          feature layers
+     * @param input getInputCount() floats
+     * @param features Array of feature layers+1 matrices to keep the input
+     *          and each feature layer's output in (can be nullptr)
+     * @return Column to give to the first dense layer
+     */
+    Matrix prepareInput(float const* input, Matrix* features);
+    /***
+     * @brief Turns sparse inputs into a full array of inputs
+     * @return New array of getInputCount() floats
+     */
+    float* makeDenseInput(int const* indices, float const* values, int count);
+
+    /***
+     * @brief Folds the normalizer into the first layer, or takes it out
+     * @param unfold Whether to take it out instead
+     */
+    void foldNormalizer(bool unfold);
+
+    /***
+     * @brief Writes a section header, with space for the size
+     * @return Where the size goes, to pass to endSection
+     */
+    static int beginSection(std::fstream& file, int section);
+    /***
+     * @brief Fills in the size of a section once it's all been written
+     */
+    static void endSection(std::fstream& file, int sizePos);
+
     int m_inputNodes;
     int m_outputNodes;
 
@@ -97,4 +561,28 @@ private:
     // arrays to matrix pointers where these values are stored
     Matrix** m_weights;
     Matrix** m_biases;
+
+    // records per-layer timings when it's not nullptr
+    Profiler* m_profiler;
+
+    // layers that run before the dense layers, usually convolutions
+    FeatureLayer** m_featureLayers;
+    int m_featureLayerCount;
+
+    // only every m_checkpointInterval-th layer output is kept for backprop
+    int m_checkpointInterval;
+    long long m_activationBytes;
+    long long m_peakActivationBytes;
+
+    LossFunction m_loss;
+
+    // weights laid out for guess, only used while m_packedVersion matches
+    //  m_weightVersion
+    PackedMatrix** m_packed;
+    long long m_packedVersion;
+    long long m_weightVersion;
+    int m_guessThreads;
+
+    // folded into the first layer, nullptr if there isn't one
+    Normalizer* m_normalizer;
 };
@@ -0,0 +1,117 @@
+#include "normalizer.hpp"
+
+#include <cmath>
+
+Normalizer::Normalizer()
+{
+    m_mode = NORMALIZE_MIN_MAX;
+}
+
+void Normalizer::fit(float const* inputs, int count, int features,
+                     NormalizeMode mode, float low, float high)
+{
+    m_mode = mode;
+    m_scale.assign(features, 1.0f);
+    m_shift.assign(features, 0.0f);
+    if(count <= 0 || features <= 0)
+        return;
+
+    if(mode == NORMALIZE_MIN_MAX)
+    {
+        std::vector<float> smallest(inputs, inputs + features);
+        std::vector<float> biggest(inputs, inputs + features);
+        float* lo = smallest.data();
+        float* hi = biggest.data();
+
+        // the inner loop goes along a sample, so every feature is updated
+        //  at once with vector min/max
+        for(int s = 1; s < count; ++s)
+        {
+            float const* row = inputs + (long long)s * features;
+            for(int f = 0; f < features; ++f)
+            {
+                lo[f] = row[f] < lo[f] ? row[f] : lo[f];
+                hi[f] = row[f] > hi[f] ? row[f] : hi[f];
+            }
+        }
+
+        for(int f = 0; f < features; ++f)
+        {
+            float range = hi[f] - lo[f];
+            if(range > 0.0f)
+            {
+                m_scale[f] = (high - low) / range;
+                m_shift[f] = low - lo[f] * m_scale[f];
+            }
+            else
+            {
+                // a feature that never changes goes to the middle, keeping a
+                //  scale of 1 so it can still be folded back out
+                m_shift[f] = (low + high) * 0.5f - lo[f];
+            }
+        }
+        return;
+    }
+
+    // Welford's running mean and variance, which doesn't lose precision
+    //  like summing squares does, again with every feature at once
+    std::vector<double> mean(features, 0.0);
+    std::vector<double> squares(features, 0.0);
+    double* m = mean.data();
+    double* m2 = squares.data();
+
+    for(int s = 0; s < count; ++s)
+    {
+        float const* row = inputs + (long long)s * features;
+        double n = 1.0 / (s + 1);
+        for(int f = 0; f < features; ++f)
+        {
+            double delta = row[f] - m[f];
+            m[f] += delta * n;
+            m2[f] += delta * (row[f] - m[f]);
+        }
+    }
+
+    for(int f = 0; f < features; ++f)
+    {
+        double deviation = sqrt(m2[f] / count);
+        if(deviation > 0.0)
+            m_scale[f] = (float)(1.0 / deviation);
+        m_shift[f] = (float)(-m[f] * m_scale[f]);
+    }
+}
+
+void Normalizer::apply(float const* input, float* output) const
+{
+    int features = getFeatureCount();
+    for(int f = 0; f < features; ++f)
+        output[f] = input[f] * m_scale[f] + m_shift[f];
+}
+
+void Normalizer::save(std::fstream& file) const
+{
+    int mode = (int)m_mode;
+    int features = getFeatureCount();
+    file.write((char*)&mode, 4);
+    file.write((char*)&features, 4);
+    file.write((char*)m_scale.data(), features * sizeof(float));
+    file.write((char*)m_shift.data(), features * sizeof(float));
+}
+
+bool Normalizer::load(std::fstream& file)
+{
+    int mode;
+    int features;
+    file.read((char*)&mode, 4);
+    file.read((char*)&features, 4);
+    if(!file || features < 0
+       || (mode != NORMALIZE_MIN_MAX && mode != NORMALIZE_STANDARD))
+        return false;
+
+    m_mode = (NormalizeMode)mode;
+    m_scale.resize(features);
+    m_shift.resize(features);
+    file.read((char*)m_scale.data(), features * sizeof(float));
+    file.read((char*)m_shift.data(), features * sizeof(float));
+    return (bool)file;
+}
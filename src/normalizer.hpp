@@ -0,0 +1,70 @@
+#pragma once
+
+#include <fstream>
+#include <vector>
+
+/***
+ * @brief How a Normalizer rescales each feature
+ */
+enum NormalizeMode
+{
+    // the smallest and biggest values seen go to the ends of a range
+    NORMALIZE_MIN_MAX,
+    // the mean goes to 0 and one standard deviation to 1
+    NORMALIZE_STANDARD
+};
+
+/***
+ * @brief Rescales each input feature with x*scale+shift, using values fit
+ *          to a data set
+ *          Give it to NeuralNetwork::setNormalizer and the rescaling is
+ *          folded into the first layer's weights, so guesses take raw
+ *          features and the rescaling costs nothing
+ */
+class Normalizer
+{
+public:
+    Normalizer();
+
+    /***
+     * @brief Works out each feature's scale and shift in one pass over a
+     *          data set
+     * @param inputs count*features floats, one sample after another
+     * @param count Number of samples
+     * @param features Number of features in each sample
+     * @param mode How to rescale the features
+     * @param low Where the smallest value goes with NORMALIZE_MIN_MAX
+     * @param high Where the biggest value goes with NORMALIZE_MIN_MAX
+     */
+    void fit(float const* inputs, int count, int features,
+             NormalizeMode mode, float low = -1.0f, float high = 1.0f);
+
+    /***
+     * @brief Rescales a sample, for when it's wanted outside a network
+     * @param input getFeatureCount() raw features
+     * @param output Array of getFeatureCount() floats for the result
+     */
+    void apply(float const* input, float* output) const;
+
+    int getFeatureCount() const { return (int)m_scale.size(); }
+    NormalizeMode getMode() const { return m_mode; }
+    float getScale(int feature) const { return m_scale[feature]; }
+    float getShift(int feature) const { return m_shift[feature]; }
+
+    /***
+     * @brief Writes the normalizer to a file
+     */
+    void save(std::fstream& file) const;
+    /***
+     * @brief Reads a normalizer written with save
+     * @return Whether it was read successfully
+     */
+    bool load(std::fstream& file);
+
+private:
+    NormalizeMode m_mode;
+
+    // each feature becomes feature*scale+shift
+    std::vector<float> m_scale;
+    std::vector<float> m_shift;
+};
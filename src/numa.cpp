@@ -0,0 +1,198 @@
+#include "numa.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "nn.hpp"
+
+// parses a sysfs cpu list like "0-3,8-11"
+static std::vector<int> parseCpuList(const char* list)
+{
+    std::vector<int> cpus;
+    const char* p = list;
+    while(*p)
+    {
+        int first, last, read;
+        if(sscanf(p, "%d-%d%n", &first, &last, &read) == 2)
+            p += read;
+        else if(sscanf(p, "%d%n", &first, &read) == 1)
+        {
+            last = first;
+            p += read;
+        }
+        else
+            break;
+
+        for(int cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+
+        if(*p == ',')
+            ++p;
+        else
+            break;
+    }
+    return cpus;
+}
+
+std::vector<NumaNode> getNumaNodes()
+{
+    std::vector<NumaNode> nodes;
+
+    DIR* dir = opendir("/sys/devices/system/node");
+    if(dir)
+    {
+        dirent* entry;
+        while((entry = readdir(dir)) != nullptr)
+        {
+            int id;
+            if(sscanf(entry->d_name, "node%d", &id) != 1)
+                continue;
+
+            char path[128];
+            snprintf(path, sizeof(path),
+                     "/sys/devices/system/node/node%d/cpulist", id);
+            FILE* file = fopen(path, "r");
+            if(!file)
+                continue;
+
+            char list[1024] = { 0 };
+            if(!fgets(list, sizeof(list), file))
+                list[0] = 0;
+            fclose(file);
+
+            NumaNode node;
+            node.id = id;
+            node.cpus = parseCpuList(list);
+
+            // nodes with only memory have nothing to run threads on
+            if(!node.cpus.empty())
+                nodes.push_back(node);
+        }
+        closedir(dir);
+    }
+
+    // only keep CPUs this process is allowed to use
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool haveAffinity = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    if(haveAffinity)
+    {
+        for(auto& node : nodes)
+        {
+            std::vector<int> usable;
+            for(int cpu : node.cpus)
+                if(cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+                    usable.push_back(cpu);
+            node.cpus = usable;
+        }
+
+        std::vector<NumaNode> usableNodes;
+        for(auto& node : nodes)
+            if(!node.cpus.empty())
+                usableNodes.push_back(node);
+        nodes = usableNodes;
+    }
+
+    if(nodes.empty())
+    {
+        // no NUMA information, treat everything as one node
+        NumaNode node;
+        node.id = 0;
+        if(haveAffinity)
+        {
+            for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+                if(CPU_ISSET(cpu, &allowed))
+                    node.cpus.push_back(cpu);
+        }
+        if(node.cpus.empty())
+        {
+            int count = (int)std::thread::hardware_concurrency();
+            for(int cpu = 0; cpu < (count > 0 ? count : 1); ++cpu)
+                node.cpus.push_back(cpu);
+        }
+        nodes.push_back(node);
+    }
+
+    return nodes;
+}
+
+bool pinThreadToCpu(int cpu)
+{
+    if(cpu < 0 || cpu >= CPU_SETSIZE)
+        return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+NumaInference::NumaInference(NeuralNetwork* network, int maxBatch,
+                             int maxWait, int workersPerNode)
+        : m_nextNode(0)
+{
+    m_nodes = getNumaNodes();
+
+    for(int n = 0; n < (int)m_nodes.size(); ++n)
+    {
+        for(int cpu : m_nodes[n].cpus)
+        {
+            if(cpu >= (int)m_cpuNodes.size())
+                m_cpuNodes.resize(cpu+1, -1);
+            m_cpuNodes[cpu] = n;
+        }
+    }
+
+    // make each node's copy from a thread running on that node so the
+    //  memory is allocated and first written there
+    m_replicas.resize(m_nodes.size(), nullptr);
+    for(int n = 0; n < (int)m_nodes.size(); ++n)
+    {
+        std::thread([this, network, n]
+        {
+            pinThreadToCpu(m_nodes[n].cpus[0]);
+            m_replicas[n] = network->copy();
+        }).join();
+    }
+
+    for(int n = 0; n < (int)m_nodes.size(); ++n)
+    {
+        std::vector<int> cpus;
+        int workers = workersPerNode > 0 ? workersPerNode
+                                         : (int)m_nodes[n].cpus.size();
+        for(int i = 0; i < workers; ++i)
+            cpus.push_back(m_nodes[n].cpus[i % m_nodes[n].cpus.size()]);
+
+        m_batchers.push_back(new Batcher(m_replicas[n], maxBatch, maxWait,
+                                         workers, cpus.data()));
+    }
+}
+
+NumaInference::~NumaInference()
+{
+    // batchers finish what's queued before the copies can go
+    for(Batcher* batcher : m_batchers)
+        delete batcher;
+    for(NeuralNetwork* replica : m_replicas)
+        delete replica;
+}
+
+void NumaInference::submit(float const* input, BatchCallback callback,
+                           void* userData)
+{
+    int node = -1;
+    int cpu = sched_getcpu();
+    if(cpu >= 0 && cpu < (int)m_cpuNodes.size())
+        node = m_cpuNodes[cpu];
+
+    // spread callers on unknown CPUs over every node
+    if(node < 0)
+        node = (int)(m_nextNode++ % m_nodes.size());
+
+    m_batchers[node]->submit(input, callback, userData);
+}
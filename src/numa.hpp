@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include "batcher.hpp"
+
+class NeuralNetwork;
+
+/***
+ * @brief A NUMA node, a group of cores sharing the same local memory
+ */
+struct NumaNode
+{
+    int id;
+    std::vector<int> cpus;
+};
+
+/***
+ * @brief Reads the machine's NUMA layout from sysfs
+ *          Machines without NUMA (or without sysfs) come back as a single
+ *          node with every CPU this process can run on
+ * @return Every node that has CPUs
+ */
+std::vector<NumaNode> getNumaNodes();
+
+/***
+ * @brief Stops the calling thread from moving off a CPU
+ * @param cpu Index of the CPU
+ * @return Whether or not it worked
+ */
+bool pinThreadToCpu(int cpu);
+
+/***
+ * @brief Runs guesses with a copy of the network on every NUMA node, with
+ *          worker threads pinned to that node's cores so they only ever read
+ *          weights from local memory
+ *          Each copy is made by a thread already pinned to its node, so the
+ *          kernel's first-touch policy puts its memory there
+ *          On a machine with one node this is just one pinned Batcher
+ */
+class NumaInference
+{
+public:
+    /***
+     * @param network Network to copy, isn't used after this
+     * @param maxBatch Most requests to guess in one batch
+     * @param maxWait Longest a request waits for its batch, in microseconds
+     * @param workersPerNode Worker threads for each node, 0 for one per core
+     */
+    NumaInference(NeuralNetwork* network, int maxBatch, int maxWait,
+                  int workersPerNode);
+    ~NumaInference();
+
+    NumaInference(NumaInference const&) = delete;
+    NumaInference& operator=(NumaInference const&) = delete;
+
+    /***
+     * @brief Queues a guess on the node the calling thread is running on,
+     *          the callback is called from one of that node's workers
+     * @param input The network's number of inputs worth of floats
+     * @param callback Function to call with the outputs
+     * @param userData Passed to the callback as is
+     */
+    void submit(float const* input, BatchCallback callback, void* userData);
+
+    /***
+     * @return Number of NUMA nodes being used
+     */
+    int getNodeCount() { return (int)m_nodes.size(); }
+
+private:
+    std::vector<NumaNode> m_nodes;
+    // which node each CPU belongs to, for finding the caller's node
+    std::vector<int> m_cpuNodes;
+
+    std::vector<NeuralNetwork*> m_replicas;
+    std::vector<Batcher*> m_batchers;
+
+    // used when the caller's CPU can't be found
+    std::atomic<unsigned int> m_nextNode;
+};
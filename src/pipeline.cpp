@@ -0,0 +1,410 @@
+#include "pipeline.hpp"
+
+#include <chrono>
+
+#include "matrix.hpp"
+#include "nn.hpp"
+
+PipelineTrainer::PipelineTrainer(NeuralNetwork* network, int stages,
+                                 int microBatches, PipelineSchedule schedule)
+{
+    m_network = network;
+    m_microBatches = microBatches < 1 ? 1 : microBatches;
+    m_schedule = schedule;
+
+    m_inputs = nullptr;
+    m_targets = nullptr;
+    m_count = 0;
+    m_batchMicroBatches = m_microBatches;
+    m_batch = 0;
+    m_finished = 0;
+    m_stopping = false;
+    m_busyTime = 0.0;
+    m_stageTime = 0.0;
+
+    int layers = network->getLayerCount();
+    if(stages > layers)
+        stages = layers;
+    if(stages < 1)
+        stages = 1;
+
+    // split the layers so every stage has about the same number of weights
+    long long total = 0;
+    for(int i = 0; i < layers; ++i)
+        total += (long long)network->m_weights[i]->getRows()
+                 * network->m_weights[i]->getColumns();
+
+    long long done = 0;
+    int layer = 0;
+    for(int s = 0; s < stages; ++s)
+    {
+        auto stage = new Stage;
+        stage->index = s;
+        stage->first = layer;
+        stage->held = 0;
+        stage->peakHeld = 0;
+        stage->busyTime = 0.0;
+
+        // at least one layer each, and one left for every stage after this
+        long long target = total * (s+1) / stages;
+        int lastAllowed = layers - (stages - s - 1);
+        do
+        {
+            Matrix* weights = network->m_weights[layer];
+            done += (long long)weights->getRows() * weights->getColumns();
+            ++layer;
+        }
+        while(layer < lastAllowed
+              && (s+1 == stages
+                  || done + (long long)network->m_weights[layer]->getRows()
+                            * network->m_weights[layer]->getColumns() / 2
+                     <= target));
+        stage->last = layer;
+
+        for(int i = stage->first; i < stage->last; ++i)
+        {
+            Matrix* weights = network->m_weights[i];
+            stage->weightGrads.push_back(new Matrix(weights->getRows(),
+                                                    weights->getColumns()));
+            stage->biasGrads.push_back(new Matrix(weights->getRows(), 1));
+        }
+        stage->saved.resize(m_microBatches);
+
+        m_stages.push_back(stage);
+    }
+
+    // every queue can hold a whole batch so a stage never waits to send
+    for(int s = 0; s < stages; ++s)
+    {
+        Stage* stage = m_stages[s];
+        stage->forwardIn = nullptr;
+        stage->backwardIn = nullptr;
+        if(s > 0)
+        {
+            stage->forwardIn = new SpscQueue<Message>(m_microBatches);
+            m_queues.push_back(stage->forwardIn);
+        }
+        if(s+1 < stages)
+        {
+            stage->backwardIn = new SpscQueue<Message>(m_microBatches);
+            m_queues.push_back(stage->backwardIn);
+        }
+    }
+
+    for(Stage* stage : m_stages)
+        stage->thread = std::thread(&PipelineTrainer::stageLoop, this, stage);
+}
+
+PipelineTrainer::~PipelineTrainer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+
+    for(Stage* stage : m_stages)
+    {
+        stage->thread.join();
+        for(Matrix* grad : stage->weightGrads)
+            delete grad;
+        for(Matrix* grad : stage->biasGrads)
+            delete grad;
+        delete stage;
+    }
+
+    for(auto queue : m_queues)
+        delete queue;
+}
+
+void PipelineTrainer::train(float const* inputs, float const* targets,
+                            int count)
+{
+    if(count < 1)
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_inputs = inputs;
+        m_targets = targets;
+        m_count = count;
+        // a short batch (like the last one of an epoch) still trains, just
+        //  with a sample in each micro-batch
+        m_batchMicroBatches = count < m_microBatches ? count
+                                                     : m_microBatches;
+        m_finished = 0;
+        m_batch++;
+    }
+    m_wake.notify_all();
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wake.wait(lock, [this]
+        {
+            return m_finished == (int)m_stages.size();
+        });
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    std::chrono::duration<double, std::micro> taken = end - start;
+    m_stageTime += taken.count() * m_stages.size();
+    for(Stage* stage : m_stages)
+        m_busyTime += stage->busyTime;
+
+    // the stages changed the weights behind the network's back
+    m_network->markWeightsChanged();
+}
+
+double PipelineTrainer::getBubbleOverhead()
+{
+    if(m_stageTime <= 0.0)
+        return 0.0;
+    return 1.0 - m_busyTime / m_stageTime;
+}
+
+int PipelineTrainer::getPeakMicroBatches()
+{
+    int peak = 0;
+    for(Stage* stage : m_stages)
+        if(stage->peakHeld > peak)
+            peak = stage->peakHeld;
+    return peak;
+}
+
+void PipelineTrainer::resetStats()
+{
+    m_busyTime = 0.0;
+    m_stageTime = 0.0;
+    for(Stage* stage : m_stages)
+        stage->peakHeld = 0;
+}
+
+void PipelineTrainer::stageLoop(Stage* stage)
+{
+    long long seen = 0;
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this, seen]
+            {
+                return m_stopping || m_batch != seen;
+            });
+            if(m_stopping)
+                return;
+            seen = m_batch;
+        }
+
+        stage->busyTime = 0.0;
+
+        int stageCount = (int)m_stages.size();
+        int microBatches = m_batchMicroBatches;
+        int warmup = microBatches;
+        if(m_schedule == PIPELINE_1F1B)
+        {
+            // enough forwards to fill the stages after this one
+            warmup = stageCount - stage->index - 1;
+            if(warmup > microBatches)
+                warmup = microBatches;
+        }
+
+        int forwards = 0;
+        int backwards = 0;
+        for(int i = 0; i < warmup; ++i)
+            forward(stage, forwards++);
+        while(forwards < microBatches)
+        {
+            forward(stage, forwards++);
+            backward(stage, backwards++);
+        }
+        while(backwards < microBatches)
+            backward(stage, backwards++);
+
+        // apply this stage's changes, averaged over the batch
+        auto start = std::chrono::steady_clock::now();
+        float scale = 1.0f / m_count;
+        for(int i = stage->first; i < stage->last; ++i)
+        {
+            Matrix& weightGrad = *stage->weightGrads[i - stage->first];
+            Matrix& biasGrad = *stage->biasGrads[i - stage->first];
+
+            Matrix weightDelta = weightGrad * scale;
+            (*m_network->m_weights[i]) += weightDelta;
+            Matrix biasDelta = biasGrad * scale;
+            (*m_network->m_biases[i]) += biasDelta;
+
+            weightGrad *= 0.0f;
+            biasGrad *= 0.0f;
+        }
+        std::chrono::duration<double, std::micro> taken =
+                std::chrono::steady_clock::now() - start;
+        stage->busyTime += taken.count();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_finished++;
+        }
+        m_wake.notify_all();
+    }
+}
+
+void PipelineTrainer::forward(Stage* stage, int microBatch)
+{
+    Matrix* input;
+    if(stage->forwardIn)
+    {
+        Message message = receive(stage->forwardIn);
+        microBatch = message.microBatch;
+        input = message.values;
+    }
+    else
+    {
+        input = nullptr;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    if(!input)
+        input = makeInputs(microBatch);
+
+    std::vector<Matrix*>& saved = stage->saved[microBatch];
+    saved.push_back(input);
+    for(int i = stage->first; i < stage->last; ++i)
+        saved.push_back(new Matrix(m_network->feedLayer(i, *saved.back())));
+
+    stage->held++;
+    if(stage->held > stage->peakHeld)
+        stage->peakHeld = stage->held;
+
+    if(stage->index+1 < (int)m_stages.size())
+    {
+        // the next stage gets its own copy, this one still needs the output
+        //  for backpropagation
+        Message message;
+        message.microBatch = microBatch;
+        message.values = new Matrix(*saved.back());
+        SpscQueue<Message>* queue = m_stages[stage->index+1]->forwardIn;
+        while(!queue->push(message))
+            std::this_thread::yield();
+    }
+
+    std::chrono::duration<double, std::micro> taken =
+            std::chrono::steady_clock::now() - start;
+    stage->busyTime += taken.count();
+}
+
+void PipelineTrainer::backward(Stage* stage, int microBatch)
+{
+    Matrix* error;
+    if(stage->backwardIn)
+    {
+        Message message = receive(stage->backwardIn);
+        microBatch = message.microBatch;
+        error = message.values;
+    }
+    else
+    {
+        error = nullptr;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<Matrix*>& saved = stage->saved[microBatch];
+
+    if(!error)
+    {
+        // the last stage works out the error from the targets
+        int first = (int)((long long)m_count * microBatch
+                          / m_batchMicroBatches);
+        int last = (int)((long long)m_count * (microBatch+1)
+                         / m_batchMicroBatches);
+        int outputs = m_network->m_outputNodes;
+
+        error = new Matrix(outputs, last - first);
+        for(int s = first; s < last; ++s)
+            for(int i = 0; i < outputs; ++i)
+                (*error)[i][s - first] = m_targets[s*outputs + i];
+        (*error) -= *saved.back();
+    }
+
+    // the same as computeGradients, for just this stage's layers
+    for(int i = stage->last-1; i >= stage->first; --i)
+    {
+        int local = i - stage->first;
+        Matrix& output = *saved[local+1];
+        Matrix& input = *saved[local];
+
+        Matrix gradient = m_network->layerGradient(i, output, *error);
+
+        Matrix& biasGrad = *stage->biasGrads[local];
+        for(int y = 0; y < gradient.getRows(); ++y)
+        {
+            float sum = 0.0f;
+            for(int x = 0; x < gradient.getColumns(); ++x)
+                sum += gradient[y][x];
+            biasGrad[y][0] += sum;
+        }
+
+        Matrix inputTrans = input.transposed();
+        Matrix weightGrad = gradient.product(inputTrans);
+        (*stage->weightGrads[local]) += weightGrad;
+
+        if(i > 0)
+        {
+            Matrix weightTrans = m_network->m_weights[i]->transposed();
+            *error = weightTrans.product(*error);
+        }
+    }
+
+    for(Matrix* values : saved)
+        delete values;
+    saved.clear();
+    stage->held--;
+
+    if(stage->index > 0)
+    {
+        Message message;
+        message.microBatch = microBatch;
+        message.values = error;
+        SpscQueue<Message>* queue = m_stages[stage->index-1]->backwardIn;
+        while(!queue->push(message))
+            std::this_thread::yield();
+    }
+    else
+    {
+        delete error;
+    }
+
+    std::chrono::duration<double, std::micro> taken =
+            std::chrono::steady_clock::now() - start;
+    stage->busyTime += taken.count();
+}
+
+PipelineTrainer::Message PipelineTrainer::receive(SpscQueue<Message>* queue)
+{
+    Message message;
+    while(!queue->pop(&message))
+        std::this_thread::yield();
+    return message;
+}
+
+Matrix* PipelineTrainer::makeInputs(int microBatch)
+{
+    int first = (int)((long long)m_count * microBatch / m_batchMicroBatches);
+    int last = (int)((long long)m_count * (microBatch+1)
+                     / m_batchMicroBatches);
+    int inputCount = m_network->getInputCount();
+    int inputNodes = m_network->m_inputNodes;
+
+    // one column per sample, like computeGradients
+    auto inputs = new Matrix(inputNodes, last - first);
+    for(int s = first; s < last; ++s)
+    {
+        Matrix column = m_network->prepareInput(m_inputs + s*inputCount,
+                                                nullptr);
+        for(int i = 0; i < inputNodes; ++i)
+            (*inputs)[i][s - first] = column[i][0];
+    }
+    return inputs;
+}
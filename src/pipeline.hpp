@@ -0,0 +1,157 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "spscqueue.hpp"
+
+class Matrix;
+class NeuralNetwork;
+
+/***
+ * @brief Order the stages of a PipelineTrainer run micro-batches in
+ */
+enum PipelineSchedule
+{
+    // every micro-batch goes forward, then every one goes backward, each
+    //  stage keeps the outputs of all of them
+    PIPELINE_GPIPE,
+    // after filling the pipeline each stage alternates one forward and one
+    //  backward, so it only keeps the outputs of up to stages micro-batches
+    PIPELINE_1F1B
+};
+
+/***
+ * @brief Trains one network with its dense layers split into contiguous
+ *          groups (stages), each group owned by its own thread
+ *          A batch is cut into micro-batches which flow forward through the
+ *          stages and their errors flow back, over lock-free queues, so the
+ *          stages work on different micro-batches at the same time and each
+ *          thread only ever touches its own layers' weights
+ *          The changes are summed over the whole batch against the weights
+ *          from before it, like computeGradients and applyGradients, so it
+ *          trains the same as a single thread does
+ *          Feature layers are run for the inputs but not trained, and the
+ *          network can't be used for anything else while it's training
+ */
+class PipelineTrainer
+{
+public:
+    /***
+     * @param network Network to train
+     * @param stages Number of threads to split the layers between, at most
+     *          the number of dense layers
+     * @param microBatches How many pieces each batch is cut into
+     * @param schedule Order to run the micro-batches in
+     */
+    PipelineTrainer(NeuralNetwork* network, int stages, int microBatches,
+                    PipelineSchedule schedule = PIPELINE_1F1B);
+    ~PipelineTrainer();
+
+    PipelineTrainer(PipelineTrainer const&) = delete;
+    PipelineTrainer& operator=(PipelineTrainer const&) = delete;
+
+    /***
+     * @brief Trains on one batch, the changes are averaged over it
+     * @param inputs count*inputs floats
+     * @param targets count*outputs floats
+     * @param count Number of samples, if there are fewer than the number
+     *          of micro-batches each sample is a micro-batch of its own
+     */
+    void train(float const* inputs, float const* targets, int count);
+
+    int getStageCount() { return (int)m_stages.size(); }
+    /***
+     * @param stage Index of the stage
+     * @return Index of the first layer the stage owns
+     */
+    int getFirstLayer(int stage) { return m_stages[stage]->first; }
+    /***
+     * @param stage Index of the stage
+     * @return One past the index of the last layer the stage owns
+     */
+    int getLastLayer(int stage) { return m_stages[stage]->last; }
+
+    /***
+     * @return Fraction of the stages' time spent waiting for other stages
+     *          (the pipeline bubble) over every batch so far
+     */
+    double getBubbleOverhead();
+    /***
+     * @return Most micro-batches any stage has held outputs for at once
+     */
+    int getPeakMicroBatches();
+    /***
+     * @brief Clears the bubble and peak measurements
+     */
+    void resetStats();
+
+private:
+    // a micro-batch's values passed between two stages
+    struct Message
+    {
+        int microBatch;
+        Matrix* values;
+    };
+
+    struct Stage
+    {
+        int index;
+        int first;
+        int last;
+
+        std::thread thread;
+        // outputs from the stage before and errors from the stage after
+        SpscQueue<Message>* forwardIn;
+        SpscQueue<Message>* backwardIn;
+
+        // changes summed over every micro-batch in the batch
+        std::vector<Matrix*> weightGrads;
+        std::vector<Matrix*> biasGrads;
+        // per micro-batch, the stage's input and each layer's output
+        std::vector<std::vector<Matrix*>> saved;
+        int held;
+        int peakHeld;
+
+        // microseconds spent working out of the last batch
+        double busyTime;
+    };
+
+    void stageLoop(Stage* stage);
+    // runs a micro-batch forward through a stage and passes it on
+    void forward(Stage* stage, int microBatch);
+    // runs a micro-batch's error back through a stage and passes it on
+    void backward(Stage* stage, int microBatch);
+    // pops from a queue, waiting for something if it's empty
+    static Message receive(SpscQueue<Message>* queue);
+    // makes the first stage's input for a micro-batch
+    Matrix* makeInputs(int microBatch);
+
+    NeuralNetwork* m_network;
+    int m_microBatches;
+    PipelineSchedule m_schedule;
+
+    std::vector<Stage*> m_stages;
+    // queues between each pair of stages, forward and backward
+    std::vector<SpscQueue<Message>*> m_queues;
+
+    // the batch being trained
+    float const* m_inputs;
+    float const* m_targets;
+    int m_count;
+    // micro-batches this batch is cut into, only fewer than m_microBatches
+    //  when there aren't enough samples
+    int m_batchMicroBatches;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    long long m_batch;
+    int m_finished;
+    bool m_stopping;
+
+    // totals for the bubble overhead
+    double m_busyTime;
+    double m_stageTime;
+};
@@ -0,0 +1,288 @@
+#include "profiler.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+#include "matrix.hpp"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// there's no glibc wrapper for perf_event_open
+static int openCounter(unsigned int type, unsigned long long config,
+                       int group)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    // the group leader starts disabled and enables the whole group at once
+    attr.disabled = group == -1 ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+Profiler::Profiler(bool hardwareCounters)
+{
+    m_counterFd = -1;
+    m_counterCount = 0;
+    for(int i = 0; i < PROFILER_COUNTERS; ++i)
+        m_counterFds[i] = -1;
+    m_counterThreadChosen = false;
+
+    if(hardwareCounters)
+        openCounters();
+}
+
+Profiler::~Profiler()
+{
+    closeCounters();
+}
+
+void Profiler::openCounters()
+{
+    m_counterThread = std::this_thread::get_id();
+
+#ifdef __linux__
+    m_counterFds[0] = openCounter(PERF_TYPE_HARDWARE,
+                                  PERF_COUNT_HW_CPU_CYCLES, -1);
+    if(m_counterFds[0] >= 0)
+    {
+        m_counterFds[1] = openCounter(PERF_TYPE_HARDWARE,
+                                      PERF_COUNT_HW_INSTRUCTIONS,
+                                      m_counterFds[0]);
+        m_counterFds[2] = openCounter(PERF_TYPE_HARDWARE,
+                                      PERF_COUNT_HW_CACHE_MISSES,
+                                      m_counterFds[0]);
+    }
+
+    // counters are usually unavailable because of perf_event_paranoid or
+    //  running in a VM, just go without them if so
+    bool ok = true;
+    for(int i = 0; i < 3; ++i)
+        if(m_counterFds[i] < 0)
+            ok = false;
+
+    if(!ok)
+    {
+        closeCounters();
+        return;
+    }
+
+    // not every CPU (or VM) exposes dTLB misses, go without just that one
+    m_counterFds[3] = openCounter(PERF_TYPE_HW_CACHE,
+                                  PERF_COUNT_HW_CACHE_DTLB
+                                  | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                  | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+                                  m_counterFds[0]);
+    m_counterCount = m_counterFds[3] >= 0 ? 4 : 3;
+
+    m_counterFd = m_counterFds[0];
+    ioctl(m_counterFd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(m_counterFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+void Profiler::closeCounters()
+{
+#ifdef __linux__
+    for(int i = 0; i < PROFILER_COUNTERS; ++i)
+    {
+        if(m_counterFds[i] >= 0)
+            close(m_counterFds[i]);
+        m_counterFds[i] = -1;
+    }
+#endif
+    m_counterFd = -1;
+    m_counterCount = 0;
+}
+
+Profiler::Sample Profiler::begin()
+{
+    // the counters only count the thread that opened them, so they move to
+    //  whichever thread the network is actually used from
+    if(!m_counterThreadChosen)
+    {
+        m_counterThreadChosen = true;
+        if(m_counterFd >= 0
+           && m_counterThread != std::this_thread::get_id())
+        {
+            closeCounters();
+            openCounters();
+        }
+    }
+
+    Sample sample;
+    readCounters(sample.counters);
+    sample.allocations = Matrix::getAllocationCount();
+    // take the time last so the other reads aren't counted
+    sample.time = std::chrono::steady_clock::now();
+    return sample;
+}
+
+void Profiler::end(Sample const& sample, int layer, bool backward,
+                   long long flops, long long bytes)
+{
+    record(m_layers, sample, layer, backward, flops, bytes);
+}
+
+void Profiler::endFeature(Sample const& sample, int layer, bool backward,
+                          long long flops, long long bytes)
+{
+    record(m_featureLayers, sample, layer, backward, flops, bytes);
+}
+
+void Profiler::record(std::vector<LayerProfile>& layers, Sample const& sample,
+                      int layer, bool backward, long long flops,
+                      long long bytes)
+{
+    auto now = std::chrono::steady_clock::now();
+    long long allocations = Matrix::getAllocationCount();
+    long long counters[PROFILER_COUNTERS];
+    readCounters(counters);
+
+    if(layer < 0)
+        return;
+    if(layer >= (int)layers.size())
+    {
+        LayerProfile empty;
+        memset(&empty, 0, sizeof(empty));
+        layers.resize(layer+1, empty);
+    }
+
+    LayerProfile& p = layers[layer];
+    std::chrono::duration<double, std::micro> taken = now - sample.time;
+    if(backward)
+    {
+        p.backwardCalls++;
+        p.backwardTime += taken.count();
+    }
+    else
+    {
+        p.forwardCalls++;
+        p.forwardTime += taken.count();
+    }
+
+    p.flops += flops;
+    p.bytes += bytes;
+    p.allocations += allocations - sample.allocations;
+
+    p.cycles += counters[0] - sample.counters[0];
+    p.instructions += counters[1] - sample.counters[1];
+    p.cacheMisses += counters[2] - sample.counters[2];
+    p.tlbMisses += counters[3] - sample.counters[3];
+}
+
+void Profiler::reset()
+{
+    m_layers.clear();
+    m_featureLayers.clear();
+    m_counterThreadChosen = false;
+}
+
+void Profiler::readCounters(long long* counters)
+{
+    for(int i = 0; i < PROFILER_COUNTERS; ++i)
+        counters[i] = 0;
+
+#ifdef __linux__
+    if(m_counterFd < 0 || m_counterThread != std::this_thread::get_id())
+        return;
+
+    // layout of a PERF_FORMAT_GROUP read
+    struct
+    {
+        unsigned long long count;
+        unsigned long long values[PROFILER_COUNTERS];
+    } data;
+
+    ssize_t expected = (ssize_t)sizeof(unsigned long long)
+                       * (1 + m_counterCount);
+    if(read(m_counterFd, &data, sizeof(data)) != expected)
+        return;
+
+    for(int i = 0; i < m_counterCount; ++i)
+        counters[i] = (long long)data.values[i];
+#endif
+}
+
+// writes one layer's entry of the JSON array
+static void writeJsonLayer(FILE* file, int layer, LayerProfile const& p,
+                           bool last)
+{
+    double ipc = p.cycles > 0 ? (double)p.instructions / p.cycles : 0.0;
+
+    fprintf(file,
+            "    {\"layer\": %d, \"forward_calls\": %lld, "
+            "\"backward_calls\": %lld, \"forward_us\": %.3f, "
+            "\"backward_us\": %.3f, \"flops\": %lld, \"bytes\": %lld, "
+            "\"allocations\": %lld, \"cycles\": %lld, "
+            "\"instructions\": %lld, \"cache_misses\": %lld, "
+            "\"tlb_misses\": %lld, \"ipc\": %.3f}%s\n",
+            layer, p.forwardCalls, p.backwardCalls, p.forwardTime,
+            p.backwardTime, p.flops, p.bytes, p.allocations, p.cycles,
+            p.instructions, p.cacheMisses, p.tlbMisses, ipc,
+            last ? "" : ",");
+}
+
+// writes one layer's row of the CSV
+static void writeCsvLayer(FILE* file, const char* kind, int layer,
+                          LayerProfile const& p)
+{
+    double ipc = p.cycles > 0 ? (double)p.instructions / p.cycles : 0.0;
+
+    fprintf(file, "%s,%d,%lld,%lld,%.3f,%.3f,%lld,%lld,%lld,%lld,%lld,%lld,"
+                  "%lld,%.3f\n",
+            kind, layer, p.forwardCalls, p.backwardCalls, p.forwardTime,
+            p.backwardTime, p.flops, p.bytes, p.allocations, p.cycles,
+            p.instructions, p.cacheMisses, p.tlbMisses, ipc);
+}
+
+bool Profiler::saveJson(const char* filename) const
+{
+    FILE* file = fopen(filename, "w");
+    if(!file)
+        return false;
+
+    fprintf(file, "{\n  \"hardware_counters\": %s,\n"
+                  "  \"feature_layers\": [\n",
+            hasHardwareCounters() ? "true" : "false");
+    for(int i = 0; i < (int)m_featureLayers.size(); ++i)
+        writeJsonLayer(file, i, m_featureLayers[i],
+                       i+1 == (int)m_featureLayers.size());
+
+    fprintf(file, "  ],\n  \"layers\": [\n");
+    for(int i = 0; i < (int)m_layers.size(); ++i)
+        writeJsonLayer(file, i, m_layers[i], i+1 == (int)m_layers.size());
+
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    return true;
+}
+
+bool Profiler::saveCsv(const char* filename) const
+{
+    FILE* file = fopen(filename, "w");
+    if(!file)
+        return false;
+
+    fprintf(file, "kind,layer,forward_calls,backward_calls,forward_us,"
+                  "backward_us,flops,bytes,allocations,cycles,instructions,"
+                  "cache_misses,tlb_misses,ipc\n");
+
+    for(int i = 0; i < (int)m_featureLayers.size(); ++i)
+        writeCsvLayer(file, "feature", i, m_featureLayers[i]);
+    for(int i = 0; i < (int)m_layers.size(); ++i)
+        writeCsvLayer(file, "dense", i, m_layers[i]);
+
+    fclose(file);
+    return true;
+}
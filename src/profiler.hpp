@@ -0,0 +1,166 @@
+#pragma once
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// cycles, instructions, cache misses and dTLB load misses
+#define PROFILER_COUNTERS 4
+
+/***
+ * @brief Everything recorded for a single layer of a network
+ */
+struct LayerProfile
+{
+    long long forwardCalls;
+    long long backwardCalls;
+
+    // total time spent in microseconds
+    double forwardTime;
+    double backwardTime;
+
+    // estimated work done, counted from the matrix sizes
+    long long flops;
+    long long bytes;
+
+    // number of heap allocations made by matrices
+    long long allocations;
+
+    // hardware counters, only filled in when they're available
+    long long cycles;
+    long long instructions;
+    long long cacheMisses;
+    long long tlbMisses;
+};
+
+/***
+ * @brief Collects per-layer timings and counters from a NeuralNetwork
+ *          Attach one with NeuralNetwork::setProfiler, and detach it again
+ *          by setting nullptr, when it's not attached it costs nothing
+ *          Dense layers and feature layers (convolutions and pooling) are
+ *          recorded separately, each numbered from 0
+ *          Not thread safe, so only attach it to a network that is used
+ *          from one thread at a time
+ *          Hardware counters only count the thread that first calls begin
+ *          (after construction or reset), anything recorded from another
+ *          thread reads 0 for them. Work done by the helper threads from
+ *          NeuralNetwork::setGuessThreads isn't counted either, only its
+ *          time is
+ */
+class Profiler
+{
+public:
+    /***
+     * @brief State captured at the start of a layer, handed back to end()
+     */
+    struct Sample
+    {
+        std::chrono::steady_clock::time_point time;
+        long long allocations;
+        long long counters[PROFILER_COUNTERS];
+    };
+
+    /***
+     * @param hardwareCounters Whether to try reading CPU cycles,
+     *          instructions, cache misses and dTLB misses through
+     *          perf_event (Linux only)
+     */
+    explicit Profiler(bool hardwareCounters = false);
+    ~Profiler();
+
+    Profiler(Profiler const&) = delete;
+    Profiler& operator=(Profiler const&) = delete;
+
+    /***
+     * @brief Marks the start of some work on a layer
+     * @return State to pass to end() once the work is done
+     */
+    Sample begin();
+    /***
+     * @brief Marks the end of some work on a layer and records it
+     * @param sample Value returned by begin()
+     * @param layer Index of the layer
+     * @param backward Whether this was backpropagation or feeding forward
+     * @param flops Floating point operations done
+     * @param bytes Bytes of memory read and written
+     */
+    void end(Sample const& sample, int layer, bool backward,
+             long long flops, long long bytes);
+    /***
+     * @brief Same as end but for a feature layer
+     * @param layer Index of the feature layer
+     */
+    void endFeature(Sample const& sample, int layer, bool backward,
+                    long long flops, long long bytes);
+
+    /***
+     * @brief Clears everything recorded so far, the next thread to call
+     *          begin gets the hardware counters
+     */
+    void reset();
+
+    /***
+     * @return Whether hardware counters are being recorded
+     */
+    bool hasHardwareCounters() const { return m_counterFd >= 0; }
+
+    /***
+     * @return Number of layers that have had something recorded
+     */
+    int getLayerCount() const { return (int)m_layers.size(); }
+    /***
+     * @param layer Index of the layer
+     * @return Everything recorded for the layer
+     */
+    LayerProfile const& getLayer(int layer) const { return m_layers[layer]; }
+    /***
+     * @return Number of feature layers that have had something recorded
+     */
+    int getFeatureLayerCount() const { return (int)m_featureLayers.size(); }
+    /***
+     * @param layer Index of the feature layer
+     * @return Everything recorded for the feature layer
+     */
+    LayerProfile const& getFeatureLayer(int layer) const
+    {
+        return m_featureLayers[layer];
+    }
+
+    /***
+     * @brief Writes the recorded results as JSON
+     * @param filename File to save to
+     * @return Whether or not saving was successful
+     */
+    bool saveJson(const char* filename) const;
+    /***
+     * @brief Writes the recorded results as CSV, one row per layer with
+     *          the feature layers first
+     * @param filename File to save to
+     * @return Whether or not saving was successful
+     */
+    bool saveCsv(const char* filename) const;
+
+private:
+    // opens the hardware counters for the calling thread
+    void openCounters();
+    void closeCounters();
+    // reads the hardware counters into counters, or zeroes if there aren't
+    //  any or this isn't the thread they count
+    void readCounters(long long* counters);
+    void record(std::vector<LayerProfile>& layers, Sample const& sample,
+                int layer, bool backward, long long flops, long long bytes);
+
+    std::vector<LayerProfile> m_layers;
+    std::vector<LayerProfile> m_featureLayers;
+
+    // perf_event group leader, -1 if hardware counters aren't available
+    int m_counterFd;
+    int m_counterFds[PROFILER_COUNTERS];
+    // how many counters are in the group, dTLB misses aren't on every CPU
+    int m_counterCount;
+    // the thread the counters count, they're opened by the constructor to
+    //  see if they're available then opened again on the first thread to
+    //  call begin if that's a different one
+    std::thread::id m_counterThread;
+    bool m_counterThreadChosen;
+};
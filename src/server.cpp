@@ -0,0 +1,249 @@
+#include "server.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "batcher.hpp"
+#include "nn.hpp"
+
+// one connected client, closed once the reader and every pending request
+//  are done with it
+struct Connection
+{
+    int fd;
+    std::mutex writeMutex;
+
+    ~Connection() { close(fd); }
+};
+
+// what a queued request needs to know to send its response
+struct PendingRequest
+{
+    std::shared_ptr<Connection> connection;
+    uint32_t id;
+    int outputCount;
+};
+
+static bool readAll(int fd, void* buffer, size_t size)
+{
+    char* data = (char*)buffer;
+    while(size > 0)
+    {
+        ssize_t got = recv(fd, data, size, 0);
+        if(got <= 0)
+            return false;
+        data += got;
+        size -= got;
+    }
+    return true;
+}
+
+static bool writeAll(int fd, void const* buffer, size_t size)
+{
+    char const* data = (char const*)buffer;
+    while(size > 0)
+    {
+        // MSG_NOSIGNAL so a client hanging up doesn't kill the server
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if(sent <= 0)
+            return false;
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static void sendResponse(float const* output, void* userData)
+{
+    auto pending = (PendingRequest*)userData;
+
+    // id and outputs go out in one write so responses can't interleave
+    std::vector<char> buffer(4 + pending->outputCount*4);
+    memcpy(buffer.data(), &pending->id, 4);
+    memcpy(buffer.data() + 4, output, pending->outputCount*4);
+
+    {
+        std::lock_guard<std::mutex> lock(pending->connection->writeMutex);
+        writeAll(pending->connection->fd, buffer.data(), buffer.size());
+    }
+
+    delete pending;
+}
+
+InferenceServer::InferenceServer(NeuralNetwork* network, int maxBatch,
+                                 int maxWait, int workers)
+{
+    m_network = network;
+    m_batcher = new Batcher(network, maxBatch, maxWait, workers);
+    m_listenFd = -1;
+    m_running = false;
+    m_clientThreads = 0;
+}
+
+InferenceServer::~InferenceServer()
+{
+    stop();
+
+    // disconnect everyone and wait for their reader threads to finish so
+    //  nothing submits to the batcher after it's gone
+    while(true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_clientMutex);
+            for(int fd : m_clientFds)
+                shutdown(fd, SHUT_RDWR);
+            if(m_clientThreads == 0)
+                break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // runs any requests that are still queued
+    delete m_batcher;
+
+    if(m_listenFd >= 0)
+        close(m_listenFd);
+}
+
+bool InferenceServer::listenUnix(const char* path)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(address.sun_path))
+        return false;
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+        return false;
+
+    unlink(path);
+    if(bind(fd, (sockaddr*)&address, sizeof(address)) < 0
+       || listen(fd, 128) < 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    m_listenFd = fd;
+    return true;
+}
+
+bool InferenceServer::listenTcp(int port)
+{
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t)port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0)
+        return false;
+
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    if(bind(fd, (sockaddr*)&address, sizeof(address)) < 0
+       || listen(fd, 128) < 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    m_listenFd = fd;
+    return true;
+}
+
+void InferenceServer::run()
+{
+    if(m_listenFd < 0)
+        return;
+
+    m_running = true;
+    while(m_running)
+    {
+        // poll with a timeout so stop() gets noticed
+        pollfd p;
+        p.fd = m_listenFd;
+        p.events = POLLIN;
+        if(poll(&p, 1, 100) <= 0)
+            continue;
+
+        int fd = accept(m_listenFd, nullptr, nullptr);
+        if(fd < 0)
+            continue;
+
+        // small requests and responses shouldn't sit in Nagle's buffer
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+        {
+            std::lock_guard<std::mutex> lock(m_clientMutex);
+            m_clientFds.push_back(fd);
+            m_clientThreads++;
+        }
+        std::thread(&InferenceServer::serveClient, this, fd).detach();
+    }
+}
+
+void InferenceServer::stop()
+{
+    m_running = false;
+}
+
+void InferenceServer::serveClient(int fd)
+{
+    auto connection = std::make_shared<Connection>();
+    connection->fd = fd;
+
+    int inputCount = m_network->getInputCount();
+    int outputCount = m_network->getOutputCount();
+
+    char serverId[] = NN_SERVER_ID;
+    uint32_t sizes[2] = { (uint32_t)inputCount, (uint32_t)outputCount };
+
+    bool ok;
+    {
+        std::lock_guard<std::mutex> lock(connection->writeMutex);
+        ok = writeAll(fd, serverId, NN_SERVER_ID_SIZE)
+             && writeAll(fd, sizes, sizeof(sizes));
+    }
+
+    std::vector<float> input(inputCount);
+    while(ok)
+    {
+        uint32_t id;
+        if(!readAll(fd, &id, 4)
+           || !readAll(fd, input.data(), inputCount*4))
+            break;
+
+        auto pending = new PendingRequest;
+        pending->connection = connection;
+        pending->id = id;
+        pending->outputCount = outputCount;
+        m_batcher->submit(input.data(), &sendResponse, pending);
+    }
+
+    std::lock_guard<std::mutex> lock(m_clientMutex);
+    for(size_t i = 0; i < m_clientFds.size(); ++i)
+    {
+        if(m_clientFds[i] == fd)
+        {
+            m_clientFds.erase(m_clientFds.begin() + i);
+            break;
+        }
+    }
+    m_clientThreads--;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+class NeuralNetwork;
+class Batcher;
+
+// written as the first 8 bytes of every connection before the sizes
+#define NN_SERVER_ID_SIZE 8
+#define NN_SERVER_ID { 'b', 'a', 'd', 'm', 'l', 'p', 's', 'v' }
+
+/***
+ * @brief Serves guesses from a network over a Unix domain socket or a
+ *          localhost TCP port, putting concurrent requests into batches
+ *
+ *          Protocol, all values little endian:
+ *
+ *          on connect the server sends
+ *          8 bytes - NN_SERVER_ID
+ *          4 bytes - number of inputs
+ *          4 bytes - number of outputs
+ *
+ *          then each request is
+ *          4 bytes - request id, chosen by the client
+ *          inputs * 4 bytes - input floats
+ *
+ *          and each response is
+ *          4 bytes - id of the request it answers
+ *          outputs * 4 bytes - output floats
+ *
+ *          Responses can come back in a different order to the requests
+ */
+class InferenceServer
+{
+public:
+    /***
+     * @param network Network to guess with, must not be trained while
+     *          the server is running
+     * @param maxBatch Most requests to guess in one batch
+     * @param maxWait Longest a request waits for its batch to fill, in
+     *          microseconds
+     * @param workers Number of threads running batches
+     */
+    InferenceServer(NeuralNetwork* network, int maxBatch, int maxWait,
+                    int workers);
+    ~InferenceServer();
+
+    InferenceServer(InferenceServer const&) = delete;
+    InferenceServer& operator=(InferenceServer const&) = delete;
+
+    /***
+     * @brief Starts listening on a Unix domain socket, replacing any file
+     *          that's already at the path
+     * @param path Path of the socket file
+     * @return Whether or not it could listen
+     */
+    bool listenUnix(const char* path);
+    /***
+     * @brief Starts listening on a TCP port on 127.0.0.1
+     * @param port Port to listen on
+     * @return Whether or not it could listen
+     */
+    bool listenTcp(int port);
+
+    /***
+     * @brief Accepts and serves connections until stop is called
+     */
+    void run();
+    /***
+     * @brief Makes run return, can be called from any thread
+     */
+    void stop();
+
+private:
+    // reads requests from one client until it disconnects
+    void serveClient(int fd);
+
+    NeuralNetwork* m_network;
+    Batcher* m_batcher;
+
+    int m_listenFd;
+    std::atomic<bool> m_running;
+
+    // sockets of connected clients so stopping can disconnect them
+    std::mutex m_clientMutex;
+    std::vector<int> m_clientFds;
+    int m_clientThreads;
+};
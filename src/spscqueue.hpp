@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+// keeps the two ends of a queue on different cache lines so the producer
+//  and consumer don't keep stealing the line from each other
+#define SPSC_CACHE_LINE 64
+
+/***
+ * @brief Fixed size queue with one thread pushing and one thread popping,
+ *          without any locks
+ *          Neither end waits, push fails when the queue is full and pop
+ *          fails when it's empty
+ */
+template<typename T>
+class SpscQueue
+{
+public:
+    /***
+     * @param capacity Most items the queue can hold at once
+     */
+    explicit SpscQueue(int capacity)
+            : m_items(capacity+1), m_head(0), m_tail(0)
+    {
+    }
+
+    SpscQueue(SpscQueue const&) = delete;
+    SpscQueue& operator=(SpscQueue const&) = delete;
+
+    /***
+     * @brief Adds an item to the back, only call from the producer thread
+     * @return Whether it was added, false if the queue was full
+     */
+    bool push(T const& item)
+    {
+        int tail = m_tail.load(std::memory_order_relaxed);
+        int next = tail+1 == (int)m_items.size() ? 0 : tail+1;
+        if(next == m_head.load(std::memory_order_acquire))
+            return false;
+
+        m_items[tail] = item;
+        m_tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /***
+     * @brief Takes the item from the front, only call from the consumer
+     *          thread
+     * @param item Where to put the item
+     * @return Whether there was an item, false if the queue was empty
+     */
+    bool pop(T* item)
+    {
+        int head = m_head.load(std::memory_order_relaxed);
+        if(head == m_tail.load(std::memory_order_acquire))
+            return false;
+
+        *item = m_items[head];
+        int next = head+1 == (int)m_items.size() ? 0 : head+1;
+        m_head.store(next, std::memory_order_release);
+        return true;
+    }
+
+private:
+    // one more slot than the capacity so full and empty look different
+    std::vector<T> m_items;
+
+    alignas(SPSC_CACHE_LINE) std::atomic<int> m_head;
+    alignas(SPSC_CACHE_LINE) std::atomic<int> m_tail;
+};
@@ -0,0 +1,343 @@
+// Compares end to end throughput and latency of lots of concurrent guesses
+//  handed to a thread pool that calls the blocking NeuralNetwork::guess,
+//  against AsyncNetwork with callbacks, futures and (built as C++20)
+//  coroutines, which batch requests that arrive close together
+//  Each of --clients clients keeps one request in flight, sending the next
+//  as soon as the last one comes back
+//
+// usage: asyncbench [network.nn] [--clients <n>] [--requests <total>]
+//                   [--threads <n>] [--batch <size>] [--wait <us>]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "async.hpp"
+#include "gmath.h"
+#include "nn.hpp"
+
+static const int s_inputSets = 256;
+
+static int s_clients = 256;
+static int s_requests = 100000;
+static int s_threads = 0;
+static int s_batch = 32;
+static int s_wait = 200;
+
+static std::vector<float> s_inputs;
+static int s_inputCount;
+
+/***
+ * @brief Hands out request ids and records how long each one took
+ */
+class Run
+{
+public:
+    Run()
+    {
+        m_next = 0;
+        m_done = 0;
+        m_starts.resize(s_requests);
+        m_latencies.resize(s_requests);
+        m_start = std::chrono::steady_clock::now();
+    }
+
+    // the id of the next request to send, or -1 once they've all been sent
+    int claim()
+    {
+        int id = m_next++;
+        if(id >= s_requests)
+            return -1;
+        m_starts[id] = std::chrono::steady_clock::now();
+        return id;
+    }
+
+    float const* input(int id)
+    {
+        return &s_inputs[(id % s_inputSets) * s_inputCount];
+    }
+
+    void complete(int id)
+    {
+        std::chrono::duration<double, std::micro> taken =
+            std::chrono::steady_clock::now() - m_starts[id];
+        m_latencies[id] = taken.count();
+
+        if(++m_done == s_requests)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_finished.notify_all();
+        }
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_finished.wait(lock, [this] { return m_done == s_requests; });
+    }
+
+    void report(const char* name)
+    {
+        std::chrono::duration<double> taken =
+            std::chrono::steady_clock::now() - m_start;
+        std::sort(m_latencies.begin(), m_latencies.end());
+        printf("%-20s %9.0f guesses/s  p50 %8.1fus  p99 %8.1fus\n", name,
+               s_requests / taken.count(), m_latencies[s_requests / 2],
+               m_latencies[(long long)s_requests * 99 / 100]);
+    }
+
+private:
+    std::atomic<int> m_next;
+    std::atomic<int> m_done;
+    std::vector<std::chrono::steady_clock::time_point> m_starts;
+    std::vector<double> m_latencies;
+    std::chrono::steady_clock::time_point m_start;
+
+    std::mutex m_mutex;
+    std::condition_variable m_finished;
+};
+
+/***
+ * @brief The usual way of keeping guess off an event loop, a plain pool of
+ *          threads each running one request at a time
+ */
+class ThreadPool
+{
+public:
+    ThreadPool(int threads)
+    {
+        m_stopping = false;
+        for(int i = 0; i < threads; ++i)
+            m_threads.emplace_back(&ThreadPool::work, this);
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+        for(auto& thread : m_threads)
+            thread.join();
+    }
+
+    void post(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tasks.push_back(std::move(task));
+        }
+        m_wake.notify_one();
+    }
+
+private:
+    void work()
+    {
+        while(true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [this]
+                {
+                    return m_stopping || !m_tasks.empty();
+                });
+                if(m_tasks.empty())
+                    return;
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::deque<std::function<void()>> m_tasks;
+    bool m_stopping;
+    std::vector<std::thread> m_threads;
+};
+
+static void sendPool(ThreadPool& pool, NeuralNetwork* network, Run& run)
+{
+    int id = run.claim();
+    if(id < 0)
+        return;
+
+    pool.post([&pool, network, &run, id]
+    {
+        thread_local std::vector<float> output;
+        output.resize(network->getOutputCount());
+        network->guess(run.input(id), output.data());
+        run.complete(id);
+        sendPool(pool, network, run);
+    });
+}
+
+static void sendCallback(AsyncNetwork& async, Run& run)
+{
+    int id = run.claim();
+    if(id < 0)
+        return;
+
+    async.guess(run.input(id), [&async, &run, id](float const*)
+    {
+        run.complete(id);
+        sendCallback(async, run);
+    });
+}
+
+#if defined(__cpp_impl_coroutine)
+// a coroutine that starts straight away and cleans itself up at the end
+struct Detached
+{
+    struct promise_type
+    {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { abort(); }
+    };
+};
+
+static Detached coroutineClient(AsyncNetwork& async, Run& run)
+{
+    for(int id = run.claim(); id >= 0; id = run.claim())
+    {
+        std::vector<float> output = co_await async.guessAsync(run.input(id));
+        run.complete(id);
+    }
+}
+#endif
+
+int main(int argc, char** argv)
+{
+    const char* filename = nullptr;
+    int first = 1;
+    if(argc > 1 && strncmp(argv[1], "--", 2) != 0)
+    {
+        filename = argv[1];
+        first = 2;
+    }
+
+    for(int i = first; i+1 < argc; i += 2)
+    {
+        if(!strcmp(argv[i], "--clients"))
+            s_clients = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--requests"))
+            s_requests = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--threads"))
+            s_threads = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--batch"))
+            s_batch = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--wait"))
+            s_wait = atoi(argv[i+1]);
+    }
+    if(s_threads < 1)
+        s_threads = (int)std::thread::hardware_concurrency();
+    if(s_threads < 1)
+        s_threads = 1;
+    if(s_clients < 1)
+        s_clients = 1;
+    if(s_requests < 1)
+        s_requests = 1;
+
+    NeuralNetwork* network;
+    if(filename)
+    {
+        network = NeuralNetwork::load(filename);
+        if(!network)
+        {
+            printf("couldn't load %s\n", filename);
+            return 1;
+        }
+    }
+    else
+    {
+        int nodes[2] = { 512, 512 };
+        network = new NeuralNetwork(256, 2, nodes, 10);
+    }
+    // the thread pool calls guess one at a time, which is quickest packed
+    network->packWeights();
+
+    s_inputCount = network->getInputCount();
+    s_inputs.resize(s_inputSets * s_inputCount);
+    for(float& value : s_inputs)
+        value = randBetween(-1.0f, 1.0f);
+
+    printf("%d clients, %d guesses, %d threads, batches of up to %d "
+           "waiting up to %dus\n", s_clients, s_requests, s_threads, s_batch,
+           s_wait);
+
+    {
+        // made first so it outlasts the workers still finishing up
+        Run run;
+        ThreadPool pool(s_threads);
+        for(int i = 0; i < s_clients; ++i)
+            sendPool(pool, network, run);
+        run.wait();
+        run.report("thread pool + guess");
+    }
+
+    {
+        // made first so it outlasts the workers still finishing up
+        Run run;
+        AsyncNetwork async(network, s_batch, s_wait, s_threads);
+        for(int i = 0; i < s_clients; ++i)
+            sendCallback(async, run);
+        run.wait();
+        run.report("async callback");
+
+        Batcher& batcher = async.getBatcher();
+        printf("%-20s %9.1f guesses per batch\n", "",
+               (double)batcher.getRequestCount() / batcher.getBatchCount());
+    }
+
+    {
+        // made first so it outlasts the workers still finishing up
+        Run run;
+        AsyncNetwork async(network, s_batch, s_wait, s_threads);
+        std::vector<std::thread> clients;
+        for(int i = 0; i < s_clients; ++i)
+        {
+            clients.emplace_back([&async, &run]
+            {
+                for(int id = run.claim(); id >= 0; id = run.claim())
+                {
+                    async.guess(run.input(id)).get();
+                    run.complete(id);
+                }
+            });
+        }
+        run.wait();
+        run.report("async future");
+        for(auto& client : clients)
+            client.join();
+    }
+
+#if defined(__cpp_impl_coroutine)
+    {
+        // made first so it outlasts the workers still finishing up
+        Run run;
+        AsyncNetwork async(network, s_batch, s_wait, s_threads);
+        for(int i = 0; i < s_clients; ++i)
+            coroutineClient(async, run);
+        run.wait();
+        run.report("async coroutine");
+    }
+#endif
+
+    delete network;
+    return 0;
+}
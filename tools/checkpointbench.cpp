@@ -0,0 +1,200 @@
+// Compares how long training stops for checkpoints saved with
+//  NeuralNetwork::save against a Checkpointer writing them in the
+//  background, then fine tunes only the output layer and compares the size
+//  of delta checkpoints against full ones. Restores from the full save and
+//  deltas at the end and checks it matches the trained network
+//
+// usage: checkpointbench [--hidden <nodes>] [--layers <count>]
+//                        [--steps <count>] [--every <steps>]
+//                        [--dir <folder for the checkpoints>]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "checkpoint.hpp"
+#include "gmath.h"
+#include "matrix.hpp"
+#include "nn.hpp"
+
+static const int s_inputs = 256;
+static const int s_outputs = 16;
+static const int s_batch = 32;
+
+static int s_hidden = 1024;
+static int s_layers = 3;
+static int s_steps = 200;
+static int s_every = 20;
+static std::string s_dir = "/tmp";
+
+static std::vector<float> s_inputValues;
+static std::vector<float> s_targetValues;
+
+static void train(NeuralNetwork* network, int step)
+{
+    int sample = step % 64;
+    network->propagate(&s_inputValues[sample * s_inputs],
+                       &s_targetValues[sample * s_outputs]);
+}
+
+// trains with full checkpoints every s_every steps, returns the seconds
+//  training spent stopped for them
+static double runFull(NeuralNetwork* network, Checkpointer* checkpointer,
+                      double& total)
+{
+    double stalled = 0.0;
+    auto start = std::chrono::steady_clock::now();
+
+    for(int step = 1; step <= s_steps; ++step)
+    {
+        train(network, step);
+        if(step % s_every != 0)
+            continue;
+
+        std::string name = s_dir + "/checkpointbench_full.nn";
+        if(checkpointer)
+        {
+            checkpointer->save(name.c_str());
+            continue;
+        }
+
+        auto saveStart = std::chrono::steady_clock::now();
+        network->save(name.c_str());
+        std::chrono::duration<double> taken =
+            std::chrono::steady_clock::now() - saveStart;
+        stalled += taken.count();
+    }
+    if(checkpointer)
+    {
+        checkpointer->wait();
+        stalled = checkpointer->getStats().stallSeconds;
+    }
+
+    std::chrono::duration<double> taken =
+        std::chrono::steady_clock::now() - start;
+    total = taken.count();
+    return stalled;
+}
+
+int main(int argc, char** argv)
+{
+    for(int i = 1; i+1 < argc; i += 2)
+    {
+        if(!strcmp(argv[i], "--hidden"))
+            s_hidden = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--layers"))
+            s_layers = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--steps"))
+            s_steps = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--every"))
+            s_every = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--dir"))
+            s_dir = argv[i+1];
+    }
+    if(s_every < 1)
+        s_every = 1;
+
+    srand(1);
+    s_inputValues.resize(64 * s_inputs);
+    s_targetValues.resize(64 * s_outputs);
+    for(float& value : s_inputValues)
+        value = randBetween(-1.0f, 1.0f);
+    for(float& value : s_targetValues)
+        value = randBetween(-0.9f, 0.9f);
+
+    std::vector<int> nodes(s_layers, s_hidden);
+    auto network = new NeuralNetwork(s_inputs, s_layers, nodes.data(),
+                                     s_outputs);
+    printf("%d parameters, checkpoint every %d of %d steps\n",
+           network->getParameterCount(), s_every, s_steps);
+
+    double total;
+    double stalled = runFull(network, nullptr, total);
+    printf("NeuralNetwork::save   %6.2fs training, %6.3fs stopped for "
+           "checkpoints\n", total, stalled);
+
+    auto checkpointer = new Checkpointer(network);
+    stalled = runFull(network, checkpointer, total);
+    printf("Checkpointer::save    %6.2fs training, %6.3fs stopped for "
+           "checkpoints\n", total, stalled);
+
+    // fine tune only the output layer, so deltas leave the rest out
+    std::string base = s_dir + "/checkpointbench_base.nn";
+    checkpointer->save(base.c_str());
+
+    int layers = network->getLayerCount();
+    auto weightGrads = new Matrix[layers];
+    auto biasGrads = new Matrix[layers];
+    std::vector<std::string> deltas;
+
+    for(int step = 1; step <= s_steps; ++step)
+    {
+        int first = (step * s_batch) % 64;
+        if(first + s_batch > 64)
+            first = 0;
+        network->computeGradients(&s_inputValues[first * s_inputs],
+                                  &s_targetValues[first * s_outputs],
+                                  s_batch, weightGrads, biasGrads, nullptr,
+                                  nullptr);
+        for(int i = 0; i < layers-1; ++i)
+        {
+            weightGrads[i] *= 0.0f;
+            biasGrads[i] *= 0.0f;
+        }
+        network->applyGradients(weightGrads, biasGrads, 1.0f / s_batch);
+
+        if(step % s_every == 0)
+        {
+            deltas.push_back(s_dir + "/checkpointbench_"
+                             + std::to_string(deltas.size()) + ".delta");
+            checkpointer->saveDelta(deltas.back().c_str());
+        }
+    }
+    bool ok = checkpointer->wait();
+
+    CheckpointStats stats = checkpointer->getStats();
+    double fullBytes = (double)network->getParameterCount() * sizeof(float);
+    double deltaBytes = 0.0;
+    for(auto& name : deltas)
+    {
+        FILE* file = fopen(name.c_str(), "rb");
+        if(!file)
+            continue;
+        fseek(file, 0, SEEK_END);
+        deltaBytes += ftell(file);
+        fclose(file);
+    }
+    if(!deltas.empty())
+        deltaBytes /= deltas.size();
+
+    printf("fine tuning deltas    %.0f bytes each against %.0f for a full "
+           "save (%.1f%%), %lld of %lld blocks changed\n", deltaBytes,
+           fullBytes, 100.0 * deltaBytes / fullBytes, stats.changedBlocks,
+           stats.totalBlocks);
+
+    std::vector<const char*> names;
+    for(auto& name : deltas)
+        names.push_back(name.c_str());
+    NeuralNetwork* restored = Checkpointer::restore(base.c_str(),
+                                                    names.data(),
+                                                    (int)names.size());
+
+    bool same = ok && restored;
+    for(int i = 0; same && i < layers; ++i)
+    {
+        same = restored->getWeights(i)->equal(*network->getWeights(i), 0.0f)
+               && restored->getBiases(i)->equal(*network->getBiases(i), 0.0f);
+    }
+    printf("restored from %s and %zu deltas: %s\n", base.c_str(),
+           deltas.size(), same ? "matches" : "DOESN'T MATCH");
+
+    delete restored;
+    delete[] weightGrads;
+    delete[] biasGrads;
+    delete checkpointer;
+    delete network;
+    return same ? 0 : 1;
+}
@@ -0,0 +1,96 @@
+// Measures the latency of single guesses, one after another, with the
+//  weights going through Matrix::product, with packed weights, and with
+//  packed weights split between threads
+//
+// usage: guesslatency <network.nn> [--guesses <count>] [--threads <count>]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "gmath.h"
+#include "nn.hpp"
+
+static void report(const char* name, std::vector<double>& times)
+{
+    std::sort(times.begin(), times.end());
+    size_t count = times.size();
+    printf("%-24s p50 %8.1fus  p99 %8.1fus  p999 %8.1fus\n", name,
+           times[count / 2], times[count * 99 / 100],
+           times[count * 999 / 1000]);
+}
+
+static std::vector<double> measure(NeuralNetwork* network, int guesses)
+{
+    std::vector<float> input(network->getInputCount());
+    std::vector<float> output(network->getOutputCount());
+    std::vector<double> times;
+    times.reserve(guesses);
+
+    // a few untimed guesses to warm the caches and start any threads
+    for(int i = 0; i < 10 + guesses; ++i)
+    {
+        for(float& value : input)
+            value = randBetween(-1.0f, 1.0f);
+
+        auto start = std::chrono::steady_clock::now();
+        network->guess(input.data(), output.data());
+        auto end = std::chrono::steady_clock::now();
+
+        std::chrono::duration<double, std::micro> taken = end - start;
+        if(i >= 10)
+            times.push_back(taken.count());
+    }
+    return times;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+        printf("usage: %s <network.nn> [--guesses n] [--threads n]\n",
+               argv[0]);
+        return 1;
+    }
+
+    int guesses = 10000;
+    int threads = (int)std::thread::hardware_concurrency();
+
+    for(int i = 2; i+1 < argc; i += 2)
+    {
+        if(!strcmp(argv[i], "--guesses"))
+            guesses = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--threads"))
+            threads = atoi(argv[i+1]);
+    }
+
+    NeuralNetwork* network = NeuralNetwork::load(argv[1]);
+    if(!network)
+    {
+        printf("couldn't load %s\n", argv[1]);
+        return 1;
+    }
+
+    std::vector<double> times = measure(network, guesses);
+    report("Matrix::product", times);
+
+    network->packWeights();
+    times = measure(network, guesses);
+    report("packed", times);
+
+    if(threads > 1)
+    {
+        network->setGuessThreads(threads);
+        times = measure(network, guesses);
+        char name[64];
+        snprintf(name, sizeof(name), "packed, %d threads", threads);
+        report(name, times);
+    }
+
+    delete network;
+    return 0;
+}
@@ -0,0 +1,181 @@
+// Compares guessBatch throughput and dTLB misses with the network's matrices
+//  on normal 4KB pages against transparent and explicit 2MB huge pages
+//  Without a network it makes a random one big enough (over 100MB of
+//  weights) for the TLB to matter
+//
+// usage: hugepagebench [network.nn] [--hidden <nodes>] [--layers <count>]
+//                      [--batch <size>] [--runs <count>]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "gmath.h"
+#include "matrix.hpp"
+#include "nn.hpp"
+#include "profiler.hpp"
+
+struct Result
+{
+    double guessesPerSecond;
+    long long tlbMisses;
+    long long hugePageBytes;
+    long long hugePageKb;
+};
+
+// how much of the process is really on huge pages, transparent or
+//  explicit, since madvise doesn't promise anything
+static long long readHugePageKb()
+{
+    FILE* file = fopen("/proc/self/smaps_rollup", "r");
+    if(!file)
+        return 0;
+
+    char line[256];
+    long long total = 0;
+    long long kb;
+    while(fgets(line, sizeof(line), file))
+    {
+        if(sscanf(line, "AnonHugePages: %lld kB", &kb) == 1
+           || sscanf(line, "Private_Hugetlb: %lld kB", &kb) == 1)
+            total += kb;
+    }
+    fclose(file);
+    return total;
+}
+
+static Result measure(MatrixAllocation policy, const char* filename,
+                      int hidden, int layers, int batch, int runs)
+{
+    // the policy only applies to matrices made after it's set, so the
+    //  network is made (or loaded) again for every policy
+    Matrix::setAllocationPolicy(policy);
+
+    NeuralNetwork* network;
+    if(filename)
+    {
+        network = NeuralNetwork::load(filename);
+    }
+    else
+    {
+        std::vector<int> nodes(layers, hidden);
+        network = new NeuralNetwork(hidden, layers, nodes.data(), hidden);
+    }
+
+    Result result;
+    memset(&result, 0, sizeof(result));
+    if(!network)
+        return result;
+
+    int inputCount = network->getInputCount();
+    int outputCount = network->getOutputCount();
+    std::vector<float> inputs((size_t)inputCount * batch);
+    std::vector<float> outputs((size_t)outputCount * batch);
+    for(float& value : inputs)
+        value = randBetween(-1.0f, 1.0f);
+
+    // one untimed run to fault every page in
+    network->guessBatch(inputs.data(), outputs.data(), batch);
+
+    Profiler profiler(true);
+    network->setProfiler(&profiler);
+
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < runs; ++i)
+        network->guessBatch(inputs.data(), outputs.data(), batch);
+    auto end = std::chrono::steady_clock::now();
+
+    network->setProfiler(nullptr);
+
+    std::chrono::duration<double> taken = end - start;
+    result.guessesPerSecond = (double)runs * batch / taken.count();
+    for(int i = 0; i < profiler.getLayerCount(); ++i)
+        result.tlbMisses += profiler.getLayer(i).tlbMisses;
+    result.hugePageBytes = Matrix::getHugePageBytes();
+    result.hugePageKb = readHugePageKb();
+
+    delete network;
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    const char* filename = nullptr;
+    int hidden = 4096;
+    int layers = 2;
+    int batch = 8;
+    int runs = 20;
+
+    int first = 1;
+    if(argc > 1 && strncmp(argv[1], "--", 2))
+    {
+        filename = argv[1];
+        first = 2;
+    }
+
+    for(int i = first; i+1 < argc; i += 2)
+    {
+        if(!strcmp(argv[i], "--hidden"))
+            hidden = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--layers"))
+            layers = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--batch"))
+            batch = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--runs"))
+            runs = atoi(argv[i+1]);
+    }
+
+    if(!filename)
+    {
+        double megabytes = (double)hidden * hidden * (layers + 1)
+                           * sizeof(float) / (1024.0 * 1024.0);
+        printf("random network, %d layers of %d nodes, %.0fMB of weights\n",
+               layers, hidden, megabytes);
+    }
+
+    const char* names[] = {
+        "normal pages",
+        "transparent huge pages",
+        "explicit huge pages",
+    };
+    MatrixAllocation policies[] = {
+        ALLOC_NORMAL,
+        ALLOC_TRANSPARENT_HUGE_PAGES,
+        ALLOC_HUGE_PAGES,
+    };
+
+    Result baseline;
+    memset(&baseline, 0, sizeof(baseline));
+    for(int p = 0; p < 3; ++p)
+    {
+        Result result = measure(policies[p], filename, hidden, layers,
+                                batch, runs);
+        if(result.guessesPerSecond <= 0.0)
+        {
+            printf("couldn't load %s\n", filename);
+            return 1;
+        }
+        if(p == 0)
+            baseline = result;
+
+        printf("%-24s %10.1f guesses/s (%.2fx)  %lld dTLB misses",
+               names[p], result.guessesPerSecond,
+               result.guessesPerSecond / baseline.guessesPerSecond,
+               result.tlbMisses);
+        if(p > 0 && baseline.tlbMisses > 0)
+            printf(" (%.1f%% fewer)",
+                   100.0 * (baseline.tlbMisses - result.tlbMisses)
+                   / baseline.tlbMisses);
+        printf("\n%-24s %lldMB mapped for huge pages, %lldMB on them\n", "",
+               result.hugePageBytes / (1024 * 1024),
+               result.hugePageKb / 1024);
+    }
+
+    Profiler check(true);
+    if(!check.hasHardwareCounters())
+        printf("hardware counters aren't available, dTLB misses read 0\n");
+
+    return 0;
+}
@@ -0,0 +1,414 @@
+// Trains a dense only network and a convolutional one on MNIST, each with
+//  tanh/squared error and softmax/cross entropy outputs, and compares their
+//  accuracy against how much work a guess takes and how long they took to
+//  reach a target accuracy
+//  With --checkpoint it trains a deep dense network instead, once for each
+//  activation checkpoint interval, and shows the memory saved against the
+//  extra training time, checking they all end up with the same weights
+//  With --prune it trains the dense network once then prunes copies of it
+//  by more and more, showing what each size costs in error and accuracy
+//  against how much quicker a guess gets
+//
+// usage: mnistbench <directory with the 4 MNIST idx files>
+//                   [--train <samples>] [--test <samples>]
+//                   [--epochs <n>] [--rate <learning rate>]
+//                   [--target <accuracy>] [--eval <samples between checks>]
+//                   [--checkpoint <hidden layers>] [--prune]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "conv.hpp"
+#include "matrix.hpp"
+#include "nn.hpp"
+
+// idx files store their sizes big endian
+static int readBigEndian(FILE* file)
+{
+    unsigned char bytes[4];
+    if(fread(bytes, 1, 4, file) != 4)
+        return -1;
+    return (bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+}
+
+// reads images as floats between 0 and 1, returns how many were read
+static int loadImages(std::string const& path, int limit,
+                      std::vector<float>& images)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if(!file)
+        return 0;
+
+    int magic = readBigEndian(file);
+    int count = readBigEndian(file);
+    int rows = readBigEndian(file);
+    int cols = readBigEndian(file);
+    if(magic != 2051 || rows != 28 || cols != 28)
+    {
+        fclose(file);
+        return 0;
+    }
+    if(count > limit)
+        count = limit;
+
+    std::vector<unsigned char> pixels(count * 784);
+    count = (int)fread(pixels.data(), 784, count, file);
+    fclose(file);
+
+    images.resize(count * 784);
+    for(int i = 0; i < count * 784; ++i)
+        images[i] = pixels[i] / 255.0f;
+    return count;
+}
+
+static int loadLabels(std::string const& path, int limit,
+                      std::vector<int>& labels)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if(!file)
+        return 0;
+
+    int magic = readBigEndian(file);
+    int count = readBigEndian(file);
+    if(magic != 2049)
+    {
+        fclose(file);
+        return 0;
+    }
+    if(count > limit)
+        count = limit;
+
+    std::vector<unsigned char> bytes(count);
+    count = (int)fread(bytes.data(), 1, count, file);
+    fclose(file);
+
+    labels.assign(bytes.begin(), bytes.begin() + count);
+    return count;
+}
+
+static float accuracy(NeuralNetwork* network, std::vector<float>& images,
+                      std::vector<int>& labels)
+{
+    int correct = 0;
+    float output[10];
+    for(size_t s = 0; s < labels.size(); ++s)
+    {
+        network->guess(&images[s * 784], output);
+
+        int best = 0;
+        for(int i = 1; i < 10; ++i)
+            if(output[i] > output[best])
+                best = i;
+        if(best == labels[s])
+            correct++;
+    }
+    return (float)correct / labels.size();
+}
+
+static int s_epochs = 1;
+static float s_target = 0.0f;
+static int s_evalEvery = 5000;
+
+static void run(const char* name, NeuralNetwork* network,
+                std::vector<float>& trainImages, std::vector<int>& trainLabels,
+                std::vector<float>& testImages, std::vector<int>& testLabels)
+{
+    // tanh outputs want 1 for the right digit and -1 for the rest, softmax
+    //  wants probabilities
+    float wrong = network->getLoss() == LOSS_MSE ? -1.0f : 0.0f;
+    float target[10];
+
+    // only training counts towards the time, not checking the accuracy
+    double trained = 0.0;
+    double reachedTarget = -1.0;
+    int seen = 0;
+
+    for(int e = 0; e < s_epochs && reachedTarget < 0.0; ++e)
+    {
+        for(size_t s = 0; s < trainLabels.size(); ++s)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for(int i = 0; i < 10; ++i)
+                target[i] = i == trainLabels[s] ? 1.0f : wrong;
+            network->propagate(&trainImages[s * 784], target);
+            std::chrono::duration<double> taken =
+                std::chrono::steady_clock::now() - start;
+            trained += taken.count();
+
+            seen++;
+            if(s_target > 0.0f && seen % s_evalEvery == 0
+               && accuracy(network, testImages, testLabels) >= s_target)
+            {
+                reachedTarget = trained;
+                break;
+            }
+        }
+    }
+
+    float acc = accuracy(network, testImages, testLabels);
+    double mflops = network->getGuessFlops() / 1e6;
+
+    printf("%-11s %8d params %7.3f MFLOP/guess  train %7.1fs  "
+           "accuracy %.4f  accuracy/MFLOP %.4f", name,
+           network->getParameterCount(), mflops, trained, acc, acc / mflops);
+    if(s_target > 0.0f)
+    {
+        if(reachedTarget >= 0.0)
+            printf("  %.4f after %.1fs (%d samples)", s_target,
+                   reachedTarget, seen);
+        else
+            printf("  never reached %.4f", s_target);
+    }
+    printf("\n");
+}
+
+// cuts the images or labels down to however many of the other there are
+static void matchCounts(std::vector<float>& images, std::vector<int>& labels)
+{
+    size_t count = images.size() / 784;
+    if(labels.size() < count)
+        count = labels.size();
+    images.resize(count * 784);
+    labels.resize(count);
+}
+
+static void runDense(const char* name, LossFunction loss, float rate,
+                     std::vector<float>& trainImages,
+                     std::vector<int>& trainLabels,
+                     std::vector<float>& testImages,
+                     std::vector<int>& testLabels)
+{
+    int hidden[1] = { 100 };
+    NeuralNetwork network(784, 1, hidden, 10);
+    network.setLoss(loss);
+    network.setLearningRate(rate);
+    run(name, &network, trainImages, trainLabels, testImages, testLabels);
+}
+
+static void runConv(const char* name, LossFunction loss, float rate,
+                    std::vector<float>& trainImages,
+                    std::vector<int>& trainLabels,
+                    std::vector<float>& testImages,
+                    std::vector<int>& testLabels)
+{
+    // 8 5x5 filters then 2x2 max pooling, down to 8x12x12 features
+    auto conv = new ConvLayer(1, 28, 28, 8, 5, 1, 0);
+    auto pool = new PoolLayer(8, conv->getOutputHeight(),
+                              conv->getOutputWidth(), 2, LAYER_POOL_MAX);
+    int hidden[1] = { 64 };
+    NeuralNetwork network(pool->getOutputSize(), 1, hidden, 10);
+    FeatureLayer* layers[2] = { conv, pool };
+    network.addFeatureLayers(layers, 2);
+    network.setLoss(loss);
+    network.setLearningRate(rate);
+    run(name, &network, trainImages, trainLabels, testImages, testLabels);
+}
+
+// compares the bits rather than the values, so a NaN matches itself
+static bool sameBits(Matrix& a, Matrix& b)
+{
+    // a matrix's values are contiguous, so its first row is all of them
+    return a.getRows() == b.getRows() && a.getColumns() == b.getColumns()
+           && !memcmp(a[0], b[0],
+                      sizeof(float) * a.getRows() * a.getColumns());
+}
+
+static bool sameWeights(NeuralNetwork* a, NeuralNetwork* b)
+{
+    for(int i = 0; i < a->getLayerCount(); ++i)
+        if(!sameBits(*a->getWeights(i), *b->getWeights(i))
+           || !sameBits(*a->getBiases(i), *b->getBiases(i)))
+            return false;
+    return true;
+}
+
+static void runCheckpoints(int layers, float rate,
+                           std::vector<float>& trainImages,
+                           std::vector<int>& trainLabels,
+                           std::vector<float>& testImages,
+                           std::vector<int>& testLabels)
+{
+    std::vector<int> hidden(layers, 128);
+    NeuralNetwork start(784, layers, hidden.data(), 10);
+    start.setLearningRate(rate);
+
+    // keeping everything, every other layer and about sqrt(layers) which
+    //  is the usual middle ground, keeping fewer than that just holds more
+    //  outputs while they're worked out again
+    std::vector<int> intervals = { 1, 2,
+                                   (int)(sqrtf((float)(layers+1)) + 0.5f) };
+    std::sort(intervals.begin(), intervals.end());
+    intervals.erase(std::unique(intervals.begin(), intervals.end()),
+                    intervals.end());
+
+    NeuralNetwork* reference = nullptr;
+    double referenceTime = 0.0;
+    for(int interval : intervals)
+    {
+        NeuralNetwork* network = start.copy();
+        network->setCheckpointInterval(interval);
+
+        float target[10];
+        double trained = 0.0;
+        long long peak = 0;
+        for(int e = 0; e < s_epochs; ++e)
+        {
+            for(size_t s = 0; s < trainLabels.size(); ++s)
+            {
+                auto begin = std::chrono::steady_clock::now();
+                for(int i = 0; i < 10; ++i)
+                    target[i] = i == trainLabels[s] ? 1.0f : -1.0f;
+                network->propagate(&trainImages[s * 784], target);
+                std::chrono::duration<double> taken =
+                    std::chrono::steady_clock::now() - begin;
+                trained += taken.count();
+
+                peak = std::max(peak, network->getPeakActivationBytes());
+            }
+        }
+
+        if(!reference)
+            referenceTime = trained;
+
+        printf("interval %2d  peak activations %8lld bytes  train %7.1fs "
+               "(%+5.1f%%)  accuracy %.4f  %s\n", interval, peak, trained,
+               100.0 * (trained - referenceTime) / referenceTime,
+               accuracy(network, testImages, testLabels),
+               !reference ? "reference"
+               : sameWeights(reference, network) ? "same weights"
+                                                 : "WEIGHTS DIFFER");
+
+        if(!reference)
+            reference = network;
+        else
+            delete network;
+    }
+    delete reference;
+}
+
+static void runPrune(float rate, std::vector<float>& trainImages,
+                     std::vector<int>& trainLabels,
+                     std::vector<float>& testImages,
+                     std::vector<int>& testLabels)
+{
+    int hidden[1] = { 100 };
+    NeuralNetwork trained(784, 1, hidden, 10);
+    trained.setLearningRate(rate);
+    run("dense", &trained, trainImages, trainLabels, testImages, testLabels);
+
+    // the start of the training set scores the neurons and measures the
+    //  error before and after
+    int calibration = (int)std::min<size_t>(1000, trainLabels.size());
+    std::vector<float> targets(calibration * 10);
+    for(int s = 0; s < calibration; ++s)
+        for(int i = 0; i < 10; ++i)
+            targets[s*10 + i] = i == trainLabels[s] ? 1.0f : -1.0f;
+
+    const char* names[2] = { "weight norm", "activation" };
+    PruneMetric metrics[2] = { PRUNE_WEIGHT_NORM, PRUNE_ACTIVATION };
+    for(int m = 0; m < 2; ++m)
+    {
+        for(int step = 1; step <= 9; ++step)
+        {
+            float fraction = step / 10.0f;
+            NeuralNetwork* network = trained.copy();
+            PruneReport report = network->prune(fraction, metrics[m],
+                                                trainImages.data(),
+                                                targets.data(), calibration);
+
+            printf("%-11s %3.0f%%  %6d params  error %.4f (%+.4f)  "
+                   "accuracy %.4f  guess %6.1fus (%.2fx)\n", names[m],
+                   fraction * 100.0f, report.paramsAfter, report.errorAfter,
+                   report.errorAfter - report.errorBefore,
+                   accuracy(network, testImages, testLabels),
+                   report.guessTimeAfter,
+                   report.guessTimeBefore / report.guessTimeAfter);
+            delete network;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+        printf("usage: %s <mnist dir> [--train n] [--test n] [--epochs n] "
+               "[--rate r] [--target accuracy] [--eval n] "
+               "[--checkpoint layers] [--prune]\n", argv[0]);
+        return 1;
+    }
+
+    int trainCount = 60000;
+    int testCount = 10000;
+    float rate = 0.01f;
+    int checkpointLayers = 0;
+    bool prune = false;
+
+    for(int i = 2; i < argc; ++i)
+    {
+        if(!strcmp(argv[i], "--train") && i+1 < argc)
+            trainCount = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--test") && i+1 < argc)
+            testCount = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--epochs") && i+1 < argc)
+            s_epochs = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--rate") && i+1 < argc)
+            rate = (float)atof(argv[++i]);
+        else if(!strcmp(argv[i], "--target") && i+1 < argc)
+            s_target = (float)atof(argv[++i]);
+        else if(!strcmp(argv[i], "--eval") && i+1 < argc)
+            s_evalEvery = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--checkpoint") && i+1 < argc)
+            checkpointLayers = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--prune"))
+            prune = true;
+    }
+
+    std::string dir = argv[1];
+    std::vector<float> trainImages, testImages;
+    std::vector<int> trainLabels, testLabels;
+
+    if(!loadImages(dir + "/train-images-idx3-ubyte", trainCount, trainImages)
+       || !loadLabels(dir + "/train-labels-idx1-ubyte", trainCount,
+                      trainLabels)
+       || !loadImages(dir + "/t10k-images-idx3-ubyte", testCount, testImages)
+       || !loadLabels(dir + "/t10k-labels-idx1-ubyte", testCount, testLabels))
+    {
+        printf("couldn't read the MNIST files in %s\n", argv[1]);
+        return 1;
+    }
+
+    // the sizes have to line up in case a file was cut short, so drop
+    //  whatever doesn't have both an image and a label
+    matchCounts(trainImages, trainLabels);
+    matchCounts(testImages, testLabels);
+
+    if(checkpointLayers > 0)
+    {
+        runCheckpoints(checkpointLayers, rate, trainImages, trainLabels,
+                       testImages, testLabels);
+        return 0;
+    }
+    if(prune)
+    {
+        runPrune(rate, trainImages, trainLabels, testImages, testLabels);
+        return 0;
+    }
+
+    runDense("dense", LOSS_MSE, rate, trainImages, trainLabels,
+             testImages, testLabels);
+    runDense("dense-xent", LOSS_SOFTMAX_CROSS_ENTROPY, rate, trainImages,
+             trainLabels, testImages, testLabels);
+    runConv("conv", LOSS_MSE, rate, trainImages, trainLabels,
+            testImages, testLabels);
+    runConv("conv-xent", LOSS_SOFTMAX_CROSS_ENTROPY, rate, trainImages,
+            trainLabels, testImages, testLabels);
+
+    return 0;
+}
@@ -0,0 +1,365 @@
+// Turns a saved network into standalone C++ with the weights baked in, so
+//  it can be used without this library, Matrix or any heap allocations
+//
+// usage: nncodegen <network.nn> <name> [--out <directory>] [--check]
+//                  [--cxx <compiler>]
+//
+// writes <name>.h and <name>.cpp with a single function:
+//   void <name>_guess(float const* input, float* output);
+// with --check it also writes <name>_check.cpp, a program comparing the
+//  generated code against outputs from NeuralNetwork::guess, then builds it
+//  (with --cxx, $CXX or g++) and runs it, exiting with 1 if it doesn't
+//  build or doesn't match
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gmath.h"
+#include "matrix.hpp"
+#include "nn.hpp"
+
+// layers with more weights than this get a loop instead of being unrolled
+static const int s_unrollLimit = 4096;
+
+static const int s_checkSamples = 64;
+
+// always has an exponent so it's a valid float literal
+static void writeFloat(FILE* file, float value)
+{
+    fprintf(file, "%.9ef", value);
+}
+
+static void writeArray(FILE* file, const char* name, Matrix& m)
+{
+    int count = m.getRows() * m.getColumns();
+    fprintf(file, "alignas(32) static constexpr float %s[%d] = {", name,
+            count);
+    for(int y = 0; y < m.getRows(); ++y)
+    {
+        for(int x = 0; x < m.getColumns(); ++x)
+        {
+            fprintf(file, (x % 4 == 0) ? "\n    " : " ");
+            writeFloat(file, m[y][x]);
+            fprintf(file, ",");
+        }
+    }
+    fprintf(file, "\n};\n\n");
+}
+
+static bool writeSource(NeuralNetwork* network, std::string const& name,
+                        std::string const& path)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if(!file)
+        return false;
+
+    fprintf(file, "// generated by nncodegen, don't edit\n\n");
+    fprintf(file, "#include \"%s.h\"\n\n#include <cmath>\n\n", name.c_str());
+
+    int layers = network->getLayerCount();
+    for(int i = 0; i < layers; ++i)
+    {
+        std::string weights = name + "_w" + std::to_string(i);
+        std::string biases = name + "_b" + std::to_string(i);
+        writeArray(file, weights.c_str(), *network->getWeights(i));
+        writeArray(file, biases.c_str(), *network->getBiases(i));
+    }
+
+    fprintf(file, "void %s_guess(float const* input, float* output)\n{\n",
+            name.c_str());
+
+    std::string last = "input";
+    for(int i = 0; i < layers; ++i)
+    {
+        Matrix& w = *network->getWeights(i);
+        int rows = w.getRows();
+        int cols = w.getColumns();
+
+        // the last layer writes straight to the output
+        std::string out = i == layers-1 ? "output" : "l" + std::to_string(i);
+        if(i < layers-1)
+            fprintf(file, "    float %s[%d];\n", out.c_str(), rows);
+
+        // cross entropy output layers get their activation afterwards
+        const char* activation = "tanhf";
+        if(i == layers-1 && network->getLoss() != LOSS_MSE)
+            activation = "";
+
+        if(rows * cols <= s_unrollLimit)
+        {
+            // constant indexes into constexpr arrays, so the compiler can
+            //  put the weights straight into the instructions
+            for(int r = 0; r < rows; ++r)
+            {
+                fprintf(file, "    %s[%d] = %s(%s_b%d[%d]", out.c_str(),
+                        r, activation, name.c_str(), i, r);
+                for(int c = 0; c < cols; ++c)
+                    fprintf(file, "\n        + %s_w%d[%d] * %s[%d]",
+                            name.c_str(), i, r*cols + c, last.c_str(), c);
+                fprintf(file, ");\n");
+            }
+        }
+        else
+        {
+            // simple loops over contiguous rows that vectorize well
+            fprintf(file, "    for(int r = 0; r < %d; ++r)\n    {\n", rows);
+            fprintf(file, "        float const* row = %s_w%d + r*%d;\n",
+                    name.c_str(), i, cols);
+            fprintf(file, "        float sum = 0.0f;\n");
+            fprintf(file, "        for(int c = 0; c < %d; ++c)\n", cols);
+            fprintf(file, "            sum += row[c] * %s[c];\n",
+                    last.c_str());
+            fprintf(file, "        %s[r] = %s(sum + %s_b%d[r]);\n",
+                    out.c_str(), activation, name.c_str(), i);
+            fprintf(file, "    }\n");
+        }
+
+        fprintf(file, "\n");
+        last = out;
+    }
+
+    int outputs = network->getOutputCount();
+    if(network->getLoss() == LOSS_SOFTMAX_CROSS_ENTROPY)
+    {
+        // same as NeuralNetwork, take away the biggest so expf can't overflow
+        fprintf(file, "    float biggest = output[0];\n");
+        fprintf(file, "    for(int i = 1; i < %d; ++i)\n", outputs);
+        fprintf(file, "        if(output[i] > biggest)\n");
+        fprintf(file, "            biggest = output[i];\n");
+        fprintf(file, "    float sum = 0.0f;\n");
+        fprintf(file, "    for(int i = 0; i < %d; ++i)\n    {\n", outputs);
+        fprintf(file, "        output[i] = expf(output[i] - biggest);\n");
+        fprintf(file, "        sum += output[i];\n    }\n");
+        fprintf(file, "    for(int i = 0; i < %d; ++i)\n", outputs);
+        fprintf(file, "        output[i] /= sum;\n");
+    }
+    else if(network->getLoss() == LOSS_SIGMOID_CROSS_ENTROPY)
+    {
+        fprintf(file, "    for(int i = 0; i < %d; ++i)\n", outputs);
+        fprintf(file,
+                "        output[i] = 1.0f / (1.0f + expf(-output[i]));\n");
+    }
+
+    fprintf(file, "}\n");
+    fclose(file);
+    return true;
+}
+
+static bool writeHeader(NeuralNetwork* network, std::string const& name,
+                        std::string const& path)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if(!file)
+        return false;
+
+    std::string upper = name;
+    for(char& c : upper)
+        c = (char)toupper(c);
+
+    fprintf(file, "// generated by nncodegen, don't edit\n\n#pragma once\n\n");
+    fprintf(file, "#define %s_INPUTS %d\n", upper.c_str(),
+            network->getInputCount());
+    fprintf(file, "#define %s_OUTPUTS %d\n\n", upper.c_str(),
+            network->getOutputCount());
+    fprintf(file, "/***\n"
+                  " * @brief Same as NeuralNetwork::guess on the network this "
+                  "was generated from\n"
+                  " * @param input %s_INPUTS floats\n"
+                  " * @param output Array of %s_OUTPUTS floats to put the "
+                  "result in\n"
+                  " */\n", upper.c_str(), upper.c_str());
+    fprintf(file, "void %s_guess(float const* input, float* output);\n",
+            name.c_str());
+
+    fclose(file);
+    return true;
+}
+
+// a program that runs the generated code on random inputs and compares
+//  against what NeuralNetwork::guess gave for them
+static bool writeCheck(NeuralNetwork* network, std::string const& name,
+                       std::string const& path)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if(!file)
+        return false;
+
+    int inputCount = network->getInputCount();
+    int outputCount = network->getOutputCount();
+
+    std::vector<float> inputs(s_checkSamples * inputCount);
+    std::vector<float> outputs(s_checkSamples * outputCount);
+    for(float& value : inputs)
+        value = randBetween(-1.0f, 1.0f);
+    for(int s = 0; s < s_checkSamples; ++s)
+        network->guess(&inputs[s * inputCount], &outputs[s * outputCount]);
+
+    fprintf(file, "// generated by nncodegen, don't edit\n"
+                  "// build with %s.cpp and run, exits with 1 if the "
+                  "generated code doesn't match\n\n", name.c_str());
+    fprintf(file, "#include \"%s.h\"\n\n", name.c_str());
+    fprintf(file, "#include <chrono>\n#include <cmath>\n#include <cstdio>\n\n");
+
+    fprintf(file, "static const float s_inputs[] = {");
+    for(size_t i = 0; i < inputs.size(); ++i)
+    {
+        fprintf(file, (i % 4 == 0) ? "\n    " : " ");
+        writeFloat(file, inputs[i]);
+        fprintf(file, ",");
+    }
+    fprintf(file, "\n};\n\nstatic const float s_expected[] = {");
+    for(size_t i = 0; i < outputs.size(); ++i)
+    {
+        fprintf(file, (i % 4 == 0) ? "\n    " : " ");
+        writeFloat(file, outputs[i]);
+        fprintf(file, ",");
+    }
+    fprintf(file, "\n};\n\n");
+
+    std::string upper = name;
+    for(char& c : upper)
+        c = (char)toupper(c);
+
+    fprintf(file,
+            "int main()\n"
+            "{\n"
+            "    const int samples = %d;\n"
+            "    float output[%s_OUTPUTS];\n"
+            "    float worst = 0.0f;\n"
+            "\n"
+            "    for(int s = 0; s < samples; ++s)\n"
+            "    {\n"
+            "        %s_guess(s_inputs + s*%s_INPUTS, output);\n"
+            "        for(int i = 0; i < %s_OUTPUTS; ++i)\n"
+            "        {\n"
+            "            float diff = fabsf(output[i] "
+            "- s_expected[s*%s_OUTPUTS + i]);\n"
+            "            if(diff > worst)\n"
+            "                worst = diff;\n"
+            "        }\n"
+            "    }\n"
+            "\n"
+            "    const int repeats = 100000;\n"
+            "    float sink = 0.0f;\n"
+            "    auto start = std::chrono::steady_clock::now();\n"
+            "    for(int r = 0; r < repeats; ++r)\n"
+            "    {\n"
+            "        %s_guess(s_inputs + (r %% samples)*%s_INPUTS, output);\n"
+            "        sink += output[0];\n"
+            "    }\n"
+            "    auto end = std::chrono::steady_clock::now();\n"
+            "    std::chrono::duration<double, std::micro> taken = "
+            "end - start;\n"
+            "\n"
+            "    printf(\"max difference %%g, %%.4fus per guess (%%g)\\n\", "
+            "worst, taken.count() / repeats, sink);\n"
+            "    return worst > 1e-4f ? 1 : 0;\n"
+            "}\n",
+            s_checkSamples, upper.c_str(), name.c_str(), upper.c_str(),
+            upper.c_str(), upper.c_str(), name.c_str(), upper.c_str());
+
+    fclose(file);
+    return true;
+}
+
+// puts a path in single quotes for the shell
+static std::string quote(std::string const& path)
+{
+    std::string quoted = "'";
+    for(char c : path)
+    {
+        if(c == '\'')
+            quoted += "'\\''";
+        else
+            quoted += c;
+    }
+    return quoted + "'";
+}
+
+// builds the check program with the generated code and runs it
+static bool runCheck(std::string const& compiler, std::string const& base)
+{
+    // so what's been printed so far comes before the compiler's output
+    fflush(stdout);
+
+    std::string program = base + "_check";
+    std::string build = compiler + " -O2 -o " + quote(program) + " "
+                        + quote(base + ".cpp") + " "
+                        + quote(base + "_check.cpp");
+    if(system(build.c_str()) != 0)
+    {
+        printf("couldn't build %s_check.cpp\n", base.c_str());
+        return false;
+    }
+
+    if(system(quote(program).c_str()) != 0)
+    {
+        printf("generated code doesn't match NeuralNetwork::guess\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 3)
+    {
+        printf("usage: %s <network.nn> <name> [--out dir] [--check] "
+               "[--cxx compiler]\n", argv[0]);
+        return 1;
+    }
+
+    std::string name = argv[2];
+    std::string dir = ".";
+    bool check = false;
+    const char* compiler = getenv("CXX");
+    if(!compiler || !*compiler)
+        compiler = "g++";
+
+    for(int i = 3; i < argc; ++i)
+    {
+        if(!strcmp(argv[i], "--out") && i+1 < argc)
+            dir = argv[++i];
+        else if(!strcmp(argv[i], "--check"))
+            check = true;
+        else if(!strcmp(argv[i], "--cxx") && i+1 < argc)
+            compiler = argv[++i];
+    }
+
+    NeuralNetwork* network = NeuralNetwork::load(argv[1]);
+    if(!network)
+    {
+        printf("couldn't load %s\n", argv[1]);
+        return 1;
+    }
+
+    if(network->getFeatureLayerCount() > 0)
+    {
+        printf("networks with feature layers aren't supported\n");
+        return 1;
+    }
+
+    std::string base = dir + "/" + name;
+    if(!writeHeader(network, name, base + ".h")
+       || !writeSource(network, name, base + ".cpp")
+       || (check && !writeCheck(network, name, base + "_check.cpp")))
+    {
+        printf("couldn't write to %s\n", dir.c_str());
+        return 1;
+    }
+
+    // for comparing with the check program's timing
+    std::vector<float> inputs(1000 * network->getInputCount());
+    for(float& value : inputs)
+        value = randBetween(-1.0f, 1.0f);
+    printf("wrote %s.h and %s.cpp, NeuralNetwork::guess takes %.4fus\n",
+           base.c_str(), base.c_str(), network->timeGuess(inputs.data(), 1000));
+    delete network;
+
+    if(check && !runCheck(compiler, base))
+        return 1;
+    return 0;
+}
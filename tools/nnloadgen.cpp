@@ -0,0 +1,191 @@
+// Sends requests to nnserve from many connections at once and reports the
+//  throughput and latency percentiles
+//
+// usage: nnloadgen (--unix <path> | --port <port>) [--connections <n>]
+//                  [--requests <per connection>]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "gmath.h"
+#include "server.hpp"
+
+static const char* s_unixPath = nullptr;
+static int s_port = 0;
+
+static bool readAll(int fd, void* buffer, size_t size)
+{
+    char* data = (char*)buffer;
+    while(size > 0)
+    {
+        ssize_t got = recv(fd, data, size, 0);
+        if(got <= 0)
+            return false;
+        data += got;
+        size -= got;
+    }
+    return true;
+}
+
+static bool writeAll(int fd, void const* buffer, size_t size)
+{
+    char const* data = (char const*)buffer;
+    while(size > 0)
+    {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if(sent <= 0)
+            return false;
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static int connectToServer()
+{
+    int fd;
+    if(s_unixPath)
+    {
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, s_unixPath, sizeof(address.sun_path)-1);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) < 0)
+            return -1;
+    }
+    else
+    {
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons((uint16_t)s_port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) < 0)
+            return -1;
+
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    }
+    return fd;
+}
+
+// sends requests one at a time and records how long each one took
+static void runClient(int requests, std::vector<double>* latencies)
+{
+    int fd = connectToServer();
+    if(fd < 0)
+        return;
+
+    char serverId[NN_SERVER_ID_SIZE];
+    char expectedId[] = NN_SERVER_ID;
+    uint32_t sizes[2];
+    if(!readAll(fd, serverId, NN_SERVER_ID_SIZE)
+       || memcmp(serverId, expectedId, NN_SERVER_ID_SIZE) != 0
+       || !readAll(fd, sizes, sizeof(sizes)))
+    {
+        close(fd);
+        return;
+    }
+
+    int inputCount = (int)sizes[0];
+    int outputCount = (int)sizes[1];
+
+    std::vector<char> request(4 + inputCount*4);
+    std::vector<char> response(4 + outputCount*4);
+
+    for(uint32_t id = 0; id < (uint32_t)requests; ++id)
+    {
+        memcpy(request.data(), &id, 4);
+        float* input = (float*)(request.data() + 4);
+        for(int i = 0; i < inputCount; ++i)
+            input[i] = randBetween(-1.0f, 1.0f);
+
+        auto start = std::chrono::steady_clock::now();
+        if(!writeAll(fd, request.data(), request.size())
+           || !readAll(fd, response.data(), response.size()))
+            break;
+        auto end = std::chrono::steady_clock::now();
+
+        std::chrono::duration<double, std::micro> taken = end - start;
+        latencies->push_back(taken.count());
+    }
+
+    close(fd);
+}
+
+int main(int argc, char** argv)
+{
+    int connections = 64;
+    int requests = 1000;
+
+    for(int i = 1; i+1 < argc; i += 2)
+    {
+        if(!strcmp(argv[i], "--unix"))
+            s_unixPath = argv[i+1];
+        else if(!strcmp(argv[i], "--port"))
+            s_port = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--connections"))
+            connections = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--requests"))
+            requests = atoi(argv[i+1]);
+    }
+
+    if(!s_unixPath && !s_port)
+    {
+        printf("usage: %s (--unix <path> | --port <port>) "
+               "[--connections n] [--requests n]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<std::vector<double>> latencies(connections);
+    std::vector<std::thread> clients;
+
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < connections; ++i)
+        clients.emplace_back(&runClient, requests, &latencies[i]);
+    for(auto& client : clients)
+        client.join();
+    auto end = std::chrono::steady_clock::now();
+
+    std::vector<double> all;
+    for(auto& l : latencies)
+        all.insert(all.end(), l.begin(), l.end());
+
+    if(all.empty())
+    {
+        printf("no requests completed\n");
+        return 1;
+    }
+
+    std::sort(all.begin(), all.end());
+    auto percentile = [&all](double p)
+    {
+        size_t index = (size_t)(p * (all.size() - 1));
+        return all[index];
+    };
+
+    std::chrono::duration<double> taken = end - start;
+    printf("%zu requests over %d connections in %.3fs\n", all.size(),
+           connections, taken.count());
+    printf("throughput: %.1f requests/s\n", all.size() / taken.count());
+    printf("latency p50: %.1fus p99: %.1fus p999: %.1fus\n",
+           percentile(0.5), percentile(0.99), percentile(0.999));
+    return 0;
+}
@@ -0,0 +1,402 @@
+// Scores a file of inputs with a saved network, as fast as the cores allow
+//  The input is raw 32 bit floats, one row of getInputCount() after another,
+//  and is mmapped so it can be much bigger than memory. Batches of rows are
+//  guessed on every core and written out in order, with only a few batches
+//  held in memory at once
+//
+// usage: nnscore <network.nn> <input.bin> <output> [--csv]
+//                [--batch <rows>] [--threads <count>] [--ahead <batches>]
+//        nnscore --convert <input.csv> <output.bin>
+//
+// --csv writes the outputs as text instead of raw floats, --convert turns a
+//  CSV file (one row of numbers per line) into the raw input format
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "nn.hpp"
+
+// turns a CSV file into raw floats a line at a time, so it works on files
+//  of any size, lines that don't start with a number (like a header) are
+//  skipped
+static int convert(const char* csvName, const char* binName)
+{
+    FILE* csv = fopen(csvName, "r");
+    if(!csv)
+    {
+        printf("couldn't open %s\n", csvName);
+        return 1;
+    }
+    FILE* bin = fopen(binName, "wb");
+    if(!bin)
+    {
+        printf("couldn't create %s\n", binName);
+        fclose(csv);
+        return 1;
+    }
+
+    char* line = nullptr;
+    size_t capacity = 0;
+    std::vector<float> row;
+    long long rows = 0;
+    long long lineNumber = 0;
+    size_t columns = 0;
+    int result = 0;
+
+    while(getline(&line, &capacity, csv) > 0)
+    {
+        ++lineNumber;
+        row.clear();
+
+        char* at = line;
+        while(true)
+        {
+            char* end;
+            float value = strtof(at, &end);
+            if(end == at)
+                break;
+            row.push_back(value);
+
+            at = end;
+            while(*at == ' ' || *at == '\t')
+                ++at;
+            if(*at != ',')
+                break;
+            ++at;
+        }
+
+        if(row.empty())
+            continue;
+        if(columns == 0)
+            columns = row.size();
+        if(row.size() != columns)
+        {
+            printf("line %lld has %zu columns instead of %zu\n", lineNumber,
+                   row.size(), columns);
+            result = 1;
+            break;
+        }
+
+        fwrite(row.data(), sizeof(float), row.size(), bin);
+        ++rows;
+    }
+
+    free(line);
+    fclose(csv);
+    if(fclose(bin) != 0)
+        result = 1;
+
+    if(result == 0)
+        printf("%lld rows of %zu columns\n", rows, columns);
+    return result;
+}
+
+/***
+ * @brief Hands out batches to the workers and writes their outputs in
+ *          order, workers can only get so far ahead of the writing
+ */
+class Scorer
+{
+public:
+    Scorer(NeuralNetwork* network, float const* inputs, long long rows,
+           int batch, int ahead, FILE* output, bool csv)
+    {
+        m_network = network;
+        m_inputs = inputs;
+        m_rows = rows;
+        m_batch = batch;
+        m_ahead = ahead;
+        m_output = output;
+        m_csv = csv;
+
+        m_inputCount = network->getInputCount();
+        m_outputCount = network->getOutputCount();
+        m_batchCount = (rows + batch - 1) / batch;
+
+        m_next = 0;
+        m_written = 0;
+        m_dropped = 0;
+        m_failed = false;
+
+        m_slots.resize(ahead);
+        m_ready.assign(ahead, false);
+        for(auto& slot : m_slots)
+            slot.resize((size_t)batch * m_outputCount);
+    }
+
+    void work()
+    {
+        GuessWorkspace workspace;
+        while(true)
+        {
+            long long index;
+            {
+                // don't take a batch that there's no room to keep yet
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [this]
+                {
+                    return m_next >= m_batchCount || m_failed
+                           || m_next < m_written + m_ahead;
+                });
+                if(m_next >= m_batchCount || m_failed)
+                    return;
+                index = m_next++;
+            }
+
+            long long first = index * m_batch;
+            int count = (int)(m_rows - first < m_batch ? m_rows - first
+                                                       : m_batch);
+            int slot = (int)(index % m_ahead);
+            m_network->guessBatch(m_inputs + first * m_inputCount,
+                                  m_slots[slot].data(), count, workspace);
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_ready[slot] = true;
+            }
+            m_wake.notify_all();
+        }
+    }
+
+    // writes batches as they're finished, on the calling thread
+    bool write()
+    {
+        while(m_written < m_batchCount)
+        {
+            int slot = (int)(m_written % m_ahead);
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [this, slot] { return m_ready[slot]; });
+            }
+
+            long long first = m_written * m_batch;
+            int count = (int)(m_rows - first < m_batch ? m_rows - first
+                                                       : m_batch);
+            if(!writeBatch(m_slots[slot].data(), count))
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_failed = true;
+                m_wake.notify_all();
+                return false;
+            }
+            dropInputs(first + count);
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_ready[slot] = false;
+                m_written++;
+            }
+            m_wake.notify_all();
+        }
+        return true;
+    }
+
+private:
+    bool writeBatch(float const* outputs, int count)
+    {
+        if(!m_csv)
+            return fwrite(outputs, sizeof(float), (size_t)count*m_outputCount,
+                          m_output) == (size_t)count*m_outputCount;
+
+        for(int r = 0; r < count; ++r)
+        {
+            for(int o = 0; o < m_outputCount; ++o)
+                fprintf(m_output, o == 0 ? "%g" : ",%g",
+                        outputs[r*m_outputCount + o]);
+            fputc('\n', m_output);
+        }
+        return !ferror(m_output);
+    }
+
+    // the inputs before this row won't be read again, so let the kernel
+    //  have their pages back straight away instead of pushing out
+    //  something more useful
+    void dropInputs(long long row)
+    {
+        long long page = sysconf(_SC_PAGESIZE);
+        long long end = row * m_inputCount * (long long)sizeof(float);
+        end -= end % page;
+        if(end <= m_dropped)
+            return;
+
+        madvise((char*)m_inputs + m_dropped, end - m_dropped, MADV_DONTNEED);
+        m_dropped = end;
+    }
+
+    NeuralNetwork* m_network;
+    float const* m_inputs;
+    long long m_rows;
+    int m_batch;
+    int m_ahead;
+    FILE* m_output;
+    bool m_csv;
+
+    int m_inputCount;
+    int m_outputCount;
+    long long m_batchCount;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    // next batch to hand out, and how many have been written
+    long long m_next;
+    long long m_written;
+    // bytes at the start of the input that have been given back
+    long long m_dropped;
+    bool m_failed;
+
+    // outputs of batches that are being worked on or waiting to be written
+    std::vector<std::vector<float>> m_slots;
+    std::vector<bool> m_ready;
+};
+
+int main(int argc, char** argv)
+{
+    if(argc == 4 && !strcmp(argv[1], "--convert"))
+        return convert(argv[2], argv[3]);
+
+    if(argc < 4)
+    {
+        printf("usage: %s <network.nn> <input.bin> <output> [--csv] "
+               "[--batch n] [--threads n] [--ahead n]\n"
+               "       %s --convert <input.csv> <output.bin>\n",
+               argv[0], argv[0]);
+        return 1;
+    }
+
+    bool csv = false;
+    int batch = 256;
+    int threads = (int)std::thread::hardware_concurrency();
+    int ahead = 0;
+    bool aheadGiven = false;
+
+    for(int i = 4; i < argc; ++i)
+    {
+        if(!strcmp(argv[i], "--csv"))
+            csv = true;
+        else if(!strcmp(argv[i], "--batch") && i+1 < argc)
+            batch = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--threads") && i+1 < argc)
+            threads = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--ahead") && i+1 < argc)
+        {
+            ahead = atoi(argv[++i]);
+            aheadGiven = true;
+        }
+    }
+    if(batch < 1)
+        batch = 1;
+    if(threads < 1)
+        threads = 1;
+    // enough for every thread to have a batch on the go while a few wait
+    //  to be written
+    if(!aheadGiven)
+        ahead = 4 * threads;
+    if(ahead < 1)
+    {
+        printf("--ahead has to be at least 1\n");
+        return 1;
+    }
+    if(ahead < threads)
+        printf("only %d batches can be ahead of the output, so at most %d of "
+               "the %d threads will be busy\n", ahead, ahead, threads);
+
+    NeuralNetwork* network = NeuralNetwork::load(argv[1]);
+    if(!network)
+    {
+        printf("couldn't load %s\n", argv[1]);
+        return 1;
+    }
+
+    int fd = open(argv[2], O_RDONLY);
+    struct stat info;
+    if(fd < 0 || fstat(fd, &info) < 0)
+    {
+        printf("couldn't open %s\n", argv[2]);
+        delete network;
+        return 1;
+    }
+
+    long long rowBytes = (long long)network->getInputCount() * sizeof(float);
+    if(info.st_size % rowBytes != 0)
+    {
+        printf("%s isn't a whole number of %d float rows\n", argv[2],
+               network->getInputCount());
+        close(fd);
+        delete network;
+        return 1;
+    }
+    long long rows = info.st_size / rowBytes;
+
+    FILE* output = fopen(argv[3], csv ? "w" : "wb");
+    if(!output)
+    {
+        printf("couldn't create %s\n", argv[3]);
+        close(fd);
+        delete network;
+        return 1;
+    }
+
+    void* mapped = nullptr;
+    if(rows > 0)
+    {
+        mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapped == MAP_FAILED)
+        {
+            printf("couldn't map %s\n", argv[2]);
+            fclose(output);
+            close(fd);
+            delete network;
+            return 1;
+        }
+        // read ahead aggressively and drop pages once they're behind us
+        madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    bool ok = true;
+    if(rows > 0)
+    {
+        Scorer scorer(network, (float const*)mapped, rows, batch, ahead,
+                      output, csv);
+
+        std::vector<std::thread> workers;
+        for(int i = 0; i < threads; ++i)
+            workers.emplace_back(&Scorer::work, &scorer);
+        ok = scorer.write();
+        for(auto& worker : workers)
+            worker.join();
+    }
+    if(fclose(output) != 0)
+        ok = false;
+
+    auto end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> taken = end - start;
+
+    if(mapped)
+        munmap(mapped, info.st_size);
+    close(fd);
+    delete network;
+
+    if(!ok)
+    {
+        printf("couldn't write %s\n", argv[3]);
+        return 1;
+    }
+
+    printf("%lld rows in %.2fs, %.0f rows/s on %d threads\n", rows,
+           taken.count(), rows / taken.count(), threads);
+    return 0;
+}
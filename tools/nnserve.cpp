@@ -0,0 +1,90 @@
+// Serves guesses from a saved network, see InferenceServer for the protocol
+//
+// usage: nnserve <network.nn> (--unix <path> | --port <port>)
+//                [--batch <max batch>] [--wait <max wait us>]
+//                [--workers <threads>]
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "nn.hpp"
+#include "server.hpp"
+
+static InferenceServer* s_server = nullptr;
+
+static void onSignal(int)
+{
+    if(s_server)
+        s_server->stop();
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+        printf("usage: %s <network.nn> (--unix <path> | --port <port>) "
+               "[--batch n] [--wait us] [--workers n]\n", argv[0]);
+        return 1;
+    }
+
+    const char* unixPath = nullptr;
+    int port = 0;
+    int maxBatch = 32;
+    int maxWait = 500;
+    int workers = (int)std::thread::hardware_concurrency();
+
+    for(int i = 2; i+1 < argc; i += 2)
+    {
+        if(!strcmp(argv[i], "--unix"))
+            unixPath = argv[i+1];
+        else if(!strcmp(argv[i], "--port"))
+            port = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--batch"))
+            maxBatch = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--wait"))
+            maxWait = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--workers"))
+            workers = atoi(argv[i+1]);
+    }
+
+    NeuralNetwork* network = NeuralNetwork::load(argv[1]);
+    if(!network)
+    {
+        printf("couldn't load %s\n", argv[1]);
+        return 1;
+    }
+    // when requests are quiet batches of one go through guess, which is
+    //  much quicker with packed weights
+    network->packWeights();
+
+    auto server = new InferenceServer(network, maxBatch, maxWait, workers);
+
+    bool listening;
+    if(unixPath)
+        listening = server->listenUnix(unixPath);
+    else
+        listening = server->listenTcp(port);
+
+    if(!listening)
+    {
+        printf("couldn't listen\n");
+        return 1;
+    }
+
+    s_server = server;
+    signal(SIGINT, &onSignal);
+    signal(SIGTERM, &onSignal);
+
+    printf("serving %s (%d inputs, %d outputs), batch %d, wait %dus, "
+           "%d workers\n", argv[1], network->getInputCount(),
+           network->getOutputCount(), maxBatch, maxWait, workers);
+    server->run();
+
+    s_server = nullptr;
+    delete server;
+    delete network;
+    return 0;
+}
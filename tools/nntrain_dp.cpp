@@ -0,0 +1,235 @@
+// Data parallel training over a ring all-reduce on localhost
+//
+// run one worker per process:
+//   nntrain_dp --rank <r> --world <n> [--port <base port>] [options]
+// or fork 1 to n workers in turn and print how well it scales:
+//   nntrain_dp --scaling <n> [options]
+//
+// options: --batch <global batch size> --steps <batches> --hidden <nodes>
+//          --rate <learning rate>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "allreduce.hpp"
+#include "dataparallel.hpp"
+#include "gmath.h"
+#include "nn.hpp"
+
+static const int s_inputs = 64;
+static const int s_outputs = 8;
+static const int s_samples = 4096;
+
+static int s_batch = 240;
+static int s_steps = 200;
+static int s_hidden = 256;
+static int s_port = 47000;
+static float s_rate = 0.1f;
+
+// the same made up data set in every process: targets are tanh of a random
+//  linear function of the inputs, so there's something to learn
+static void makeData(std::vector<float>& inputs, std::vector<float>& targets)
+{
+    srand(1);
+
+    std::vector<float> mix(s_inputs * s_outputs);
+    for(float& m : mix)
+        m = randBetween(-0.3f, 0.3f);
+
+    inputs.resize(s_samples * s_inputs);
+    targets.resize(s_samples * s_outputs);
+    for(int s = 0; s < s_samples; ++s)
+    {
+        float* in = &inputs[s * s_inputs];
+        for(int i = 0; i < s_inputs; ++i)
+            in[i] = randBetween(-1.0f, 1.0f);
+
+        for(int o = 0; o < s_outputs; ++o)
+        {
+            float sum = 0.0f;
+            for(int i = 0; i < s_inputs; ++i)
+                sum += mix[o*s_inputs + i] * in[i];
+            targets[s*s_outputs + o] = tanhf(sum);
+        }
+    }
+}
+
+// trains as one rank, returns samples per second over the whole ring
+//  or a negative number if something went wrong
+static double runWorker(int rank, int world, int port)
+{
+    if(s_batch % world != 0)
+    {
+        printf("batch %d doesn't split evenly over %d workers\n",
+               s_batch, world);
+        return -1.0;
+    }
+
+    std::vector<float> inputs, targets;
+    makeData(inputs, targets);
+
+    int hidden[2] = { s_hidden, s_hidden };
+    srand(100 + rank);
+    NeuralNetwork network(s_inputs, 2, hidden, s_outputs);
+    network.setLearningRate(s_rate);
+
+    RingAllReduce ring(rank, world, "127.0.0.1", port);
+    if(!ring.connect(10000))
+    {
+        printf("rank %d couldn't connect\n", rank);
+        return -1.0;
+    }
+
+    DataParallelTrainer trainer(&network, &ring);
+    if(!trainer.synchronize())
+        return -1.0;
+
+    if(rank == 0)
+        printf("world %d: starting error %.5f\n", world,
+               network.meanSquaredError(inputs.data(), targets.data(), 512));
+
+    int share = s_batch / world;
+    int batches = s_samples / s_batch;
+
+    auto start = std::chrono::steady_clock::now();
+    for(int step = 0; step < s_steps; ++step)
+    {
+        int first = (step % batches) * s_batch + rank * share;
+        if(!trainer.train(&inputs[first * s_inputs],
+                          &targets[first * s_outputs], share))
+            return -1.0;
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    std::chrono::duration<double> taken = end - start;
+    double rate = (double)s_steps * s_batch / taken.count();
+
+    if(rank == 0)
+    {
+        float error = network.meanSquaredError(inputs.data(), targets.data(),
+                                               512);
+        printf("world %d: %.0f samples/s, error %.5f\n", world, rate, error);
+    }
+    return rate;
+}
+
+// the plain one sample at a time trainer, for comparison
+static double runPropagate()
+{
+    std::vector<float> inputs, targets;
+    makeData(inputs, targets);
+
+    int hidden[2] = { s_hidden, s_hidden };
+    NeuralNetwork network(s_inputs, 2, hidden, s_outputs);
+    network.setLearningRate(s_rate);
+
+    int count = s_steps * s_batch / 10;
+    auto start = std::chrono::steady_clock::now();
+    for(int s = 0; s < count; ++s)
+    {
+        int sample = s % s_samples;
+        network.propagate(&inputs[sample * s_inputs],
+                          &targets[sample * s_outputs]);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    std::chrono::duration<double> taken = end - start;
+    return count / taken.count();
+}
+
+int main(int argc, char** argv)
+{
+    int rank = -1;
+    int world = 1;
+    int scaling = 0;
+
+    for(int i = 1; i+1 < argc; i += 2)
+    {
+        if(!strcmp(argv[i], "--rank"))
+            rank = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--world"))
+            world = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--port"))
+            s_port = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--scaling"))
+            scaling = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--batch"))
+            s_batch = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--steps"))
+            s_steps = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--hidden"))
+            s_hidden = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--rate"))
+            s_rate = (float)atof(argv[i+1]);
+    }
+
+    if(rank >= 0)
+        return runWorker(rank, world, s_port) < 0.0 ? 1 : 0;
+
+    if(scaling <= 0)
+    {
+        printf("usage: %s --rank <r> --world <n> | --scaling <n> "
+               "[--port p] [--batch n] [--steps n] [--hidden n] [--rate r]\n",
+               argv[0]);
+        return 1;
+    }
+
+    printf("propagate (one sample at a time): %.0f samples/s\n",
+           runPropagate());
+
+    double baseline = 0.0;
+    for(int n = 1; n <= scaling; ++n)
+    {
+        // rank 0 reports its rate back through a pipe
+        int fds[2];
+        if(pipe(fds) < 0)
+            return 1;
+
+        // every world size gets its own ports so old sockets don't get
+        //  in the way
+        int port = s_port + n * 64;
+        fflush(stdout);
+        for(int r = 0; r < n; ++r)
+        {
+            if(fork() == 0)
+            {
+                close(fds[0]);
+                double rate = runWorker(r, n, port);
+                if(r == 0)
+                {
+                    ssize_t written = write(fds[1], &rate, sizeof(rate));
+                    (void)written;
+                }
+                // _exit skips stdio's buffers
+                fflush(stdout);
+                _exit(rate < 0.0 ? 1 : 0);
+            }
+        }
+        close(fds[1]);
+
+        double rate = -1.0;
+        if(read(fds[0], &rate, sizeof(rate)) != (ssize_t)sizeof(rate))
+            rate = -1.0;
+        close(fds[0]);
+        while(wait(nullptr) > 0)
+            ;
+
+        if(rate < 0.0)
+        {
+            printf("world %d failed\n", n);
+            return 1;
+        }
+        if(n == 1)
+            baseline = rate;
+        printf("world %d: speedup %.2fx over one process\n", n,
+               rate / baseline);
+    }
+    return 0;
+}
@@ -0,0 +1,259 @@
+// Pipeline parallel training of a deep network, compared against one
+//  thread and against data parallel training with the same number of
+//  workers (run as threads on a localhost ring)
+//
+// usage: nntrain_pp [--stages <threads>] [--micro <micro-batches>]
+//                   [--batch <size>] [--steps <batches>] [--layers <count>]
+//                   [--hidden <nodes>] [--rate <learning rate>]
+//                   [--port <base port>]
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "allreduce.hpp"
+#include "dataparallel.hpp"
+#include "gmath.h"
+#include "matrix.hpp"
+#include "nn.hpp"
+#include "pipeline.hpp"
+
+static const int s_inputs = 64;
+static const int s_outputs = 8;
+static const int s_samples = 4096;
+
+static int s_stages = 4;
+static int s_micro = 8;
+static int s_batch = 256;
+static int s_steps = 50;
+static int s_layers = 8;
+static int s_hidden = 256;
+static float s_rate = 0.01f;
+static int s_port = 47500;
+
+// targets are tanh of a random linear function of the inputs, the same as
+//  nntrain_dp
+static void makeData(std::vector<float>& inputs, std::vector<float>& targets)
+{
+    srand(1);
+
+    std::vector<float> mix(s_inputs * s_outputs);
+    for(float& m : mix)
+        m = randBetween(-0.3f, 0.3f);
+
+    inputs.resize(s_samples * s_inputs);
+    targets.resize(s_samples * s_outputs);
+    for(int s = 0; s < s_samples; ++s)
+    {
+        float* in = &inputs[s * s_inputs];
+        for(int i = 0; i < s_inputs; ++i)
+            in[i] = randBetween(-1.0f, 1.0f);
+
+        for(int o = 0; o < s_outputs; ++o)
+        {
+            float sum = 0.0f;
+            for(int i = 0; i < s_inputs; ++i)
+                sum += mix[o*s_inputs + i] * in[i];
+            targets[s*s_outputs + o] = tanhf(sum);
+        }
+    }
+}
+
+// every run starts from the same weights
+static NeuralNetwork* makeNetwork()
+{
+    std::vector<int> hidden(s_layers, s_hidden);
+    srand(100);
+    auto network = new NeuralNetwork(s_inputs, s_layers, hidden.data(),
+                                     s_outputs);
+    network->setLearningRate(s_rate);
+    return network;
+}
+
+static void report(const char* name, double rate, double baseline,
+                   float error)
+{
+    printf("%-28s %8.0f samples/s (%.2fx)  error %.5f\n", name, rate,
+           rate / baseline, error);
+}
+
+// trains with some function taking the first sample of each batch,
+//  returns samples per second
+template<typename Train>
+static double measure(Train train)
+{
+    int batches = s_samples / s_batch;
+
+    auto start = std::chrono::steady_clock::now();
+    for(int step = 0; step < s_steps; ++step)
+        train((step % batches) * s_batch);
+    auto end = std::chrono::steady_clock::now();
+
+    std::chrono::duration<double> taken = end - start;
+    return (double)s_steps * s_batch / taken.count();
+}
+
+// data parallel over a ring of threads, returns samples per second or a
+//  negative number if the ring didn't work out
+static double runDataParallel(std::vector<float>& inputs,
+                              std::vector<float>& targets, float* error)
+{
+    int world = s_stages;
+    int share = s_batch / world;
+    std::vector<double> rates(world, -1.0);
+    std::vector<std::thread> workers;
+
+    // rand isn't thread safe, so the networks are made up front
+    std::vector<NeuralNetwork*> networks;
+    for(int r = 0; r < world; ++r)
+        networks.push_back(makeNetwork());
+
+    for(int r = 0; r < world; ++r)
+    {
+        workers.emplace_back([&, r]
+        {
+            NeuralNetwork* network = networks[r];
+            RingAllReduce ring(r, world, "127.0.0.1", s_port);
+            if(!ring.connect(10000))
+            {
+                delete network;
+                return;
+            }
+
+            DataParallelTrainer trainer(network, &ring);
+            if(!trainer.synchronize())
+            {
+                delete network;
+                return;
+            }
+
+            bool ok = true;
+            rates[r] = measure([&](int first)
+            {
+                first += r * share;
+                ok = trainer.train(&inputs[first * s_inputs],
+                                   &targets[first * s_outputs], share) && ok;
+            });
+            if(!ok)
+                rates[r] = -1.0;
+
+            if(r == 0)
+                *error = network->meanSquaredError(inputs.data(),
+                                                   targets.data(), 512);
+            delete network;
+        });
+    }
+    for(auto& worker : workers)
+        worker.join();
+
+    for(double rate : rates)
+        if(rate < 0.0)
+            return -1.0;
+    return rates[0];
+}
+
+int main(int argc, char** argv)
+{
+    for(int i = 1; i+1 < argc; i += 2)
+    {
+        if(!strcmp(argv[i], "--stages"))
+            s_stages = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--micro"))
+            s_micro = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--batch"))
+            s_batch = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--steps"))
+            s_steps = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--layers"))
+            s_layers = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--hidden"))
+            s_hidden = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--rate"))
+            s_rate = (float)atof(argv[i+1]);
+        else if(!strcmp(argv[i], "--port"))
+            s_port = atoi(argv[i+1]);
+    }
+
+    if(s_stages < 1 || s_micro < 1 || s_batch < s_micro
+       || s_batch > s_samples)
+    {
+        printf("usage: %s [--stages n] [--micro n] [--batch n] [--steps n] "
+               "[--layers n] [--hidden n] [--rate r] [--port p]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<float> inputs, targets;
+    makeData(inputs, targets);
+
+    printf("%d hidden layers of %d, batches of %d, %d stages, "
+           "%d micro-batches\n", s_layers, s_hidden, s_batch, s_stages,
+           s_micro);
+
+    // one thread working out the whole batch's changes at once
+    double baseline;
+    {
+        NeuralNetwork* network = makeNetwork();
+        std::vector<Matrix> weightGrads(network->getLayerCount());
+        std::vector<Matrix> biasGrads(network->getLayerCount());
+        baseline = measure([&](int first)
+        {
+            network->computeGradients(&inputs[first * s_inputs],
+                                      &targets[first * s_outputs], s_batch,
+                                      weightGrads.data(), biasGrads.data(),
+                                      nullptr, nullptr);
+            network->applyGradients(weightGrads.data(), biasGrads.data(),
+                                    1.0f / s_batch);
+        });
+        report("one thread", baseline, baseline,
+               network->meanSquaredError(inputs.data(), targets.data(), 512));
+        delete network;
+    }
+
+    if(s_batch % s_stages == 0)
+    {
+        float error = 0.0f;
+        double rate = runDataParallel(inputs, targets, &error);
+        char name[64];
+        snprintf(name, sizeof(name), "data parallel, %d workers", s_stages);
+        if(rate < 0.0)
+            printf("%-28s couldn't connect the ring\n", name);
+        else
+            report(name, rate, baseline, error);
+    }
+    else
+    {
+        printf("batch %d doesn't split evenly over %d workers, skipping "
+               "data parallel\n", s_batch, s_stages);
+    }
+
+    const char* names[] = { "pipeline, GPipe", "pipeline, 1F1B" };
+    PipelineSchedule schedules[] = { PIPELINE_GPIPE, PIPELINE_1F1B };
+    for(int i = 0; i < 2; ++i)
+    {
+        NeuralNetwork* network = makeNetwork();
+        PipelineTrainer trainer(network, s_stages, s_micro, schedules[i]);
+
+        double rate = measure([&](int first)
+        {
+            trainer.train(&inputs[first * s_inputs],
+                          &targets[first * s_outputs], s_batch);
+        });
+        report(names[i], rate, baseline,
+               network->meanSquaredError(inputs.data(), targets.data(), 512));
+
+        // the fraction of time an ideal pipeline spends filling and
+        //  draining
+        int stages = trainer.getStageCount();
+        double ideal = (double)(stages - 1) / (s_micro + stages - 1);
+        printf("%-28s bubble %.1f%% (ideal %.1f%%), up to %d micro-batches "
+               "held per stage\n", "", 100.0 * trainer.getBubbleOverhead(),
+               100.0 * ideal, trainer.getPeakMicroBatches());
+
+        delete network;
+    }
+    return 0;
+}
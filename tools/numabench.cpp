@@ -0,0 +1,129 @@
+// Prints the NUMA layout and compares guess throughput between one shared
+//  network with unpinned workers and NumaInference's per-node copies
+//
+// usage: numabench <network.nn> [--clients <threads>] [--requests <each>]
+//                  [--batch <max batch>] [--wait <max wait us>]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "batcher.hpp"
+#include "gmath.h"
+#include "nn.hpp"
+#include "numa.hpp"
+
+static void onGuessed(float const*, void* userData)
+{
+    ((std::promise<void>*)userData)->set_value();
+}
+
+// every client sends a request and waits for it before sending the next
+template<typename Submit>
+static double measure(int clients, int requests, int inputCount,
+                      Submit submit)
+{
+    std::vector<std::thread> threads;
+
+    auto start = std::chrono::steady_clock::now();
+    for(int c = 0; c < clients; ++c)
+    {
+        threads.emplace_back([&submit, requests, inputCount]
+        {
+            std::vector<float> input(inputCount);
+            for(int r = 0; r < requests; ++r)
+            {
+                for(float& value : input)
+                    value = randBetween(-1.0f, 1.0f);
+
+                std::promise<void> done;
+                submit(input.data(), &done);
+                done.get_future().wait();
+            }
+        });
+    }
+    for(auto& thread : threads)
+        thread.join();
+    auto end = std::chrono::steady_clock::now();
+
+    std::chrono::duration<double> taken = end - start;
+    return clients * requests / taken.count();
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+        printf("usage: %s <network.nn> [--clients n] [--requests n] "
+               "[--batch n] [--wait us]\n", argv[0]);
+        return 1;
+    }
+
+    int clients = 2 * (int)std::thread::hardware_concurrency();
+    int requests = 2000;
+    int maxBatch = 16;
+    int maxWait = 200;
+
+    for(int i = 2; i+1 < argc; i += 2)
+    {
+        if(!strcmp(argv[i], "--clients"))
+            clients = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--requests"))
+            requests = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--batch"))
+            maxBatch = atoi(argv[i+1]);
+        else if(!strcmp(argv[i], "--wait"))
+            maxWait = atoi(argv[i+1]);
+    }
+
+    NeuralNetwork* network = NeuralNetwork::load(argv[1]);
+    if(!network)
+    {
+        printf("couldn't load %s\n", argv[1]);
+        return 1;
+    }
+
+    std::vector<NumaNode> nodes = getNumaNodes();
+    for(auto& node : nodes)
+    {
+        printf("node %d:", node.id);
+        for(int cpu : node.cpus)
+            printf(" %d", cpu);
+        printf("\n");
+    }
+
+    int inputCount = network->getInputCount();
+    int cpuCount = 0;
+    for(auto& node : nodes)
+        cpuCount += (int)node.cpus.size();
+
+    double shared;
+    {
+        Batcher batcher(network, maxBatch, maxWait, cpuCount);
+        shared = measure(clients, requests, inputCount,
+                         [&batcher](float const* input, void* done)
+        {
+            batcher.submit(input, &onGuessed, done);
+        });
+    }
+    printf("shared network, unpinned:  %.0f guesses/s\n", shared);
+
+    double local;
+    {
+        NumaInference numa(network, maxBatch, maxWait, 0);
+        local = measure(clients, requests, inputCount,
+                        [&numa](float const* input, void* done)
+        {
+            numa.submit(input, &onGuessed, done);
+        });
+    }
+    printf("copy per node, pinned:     %.0f guesses/s (%.2fx)\n", local,
+           local / shared);
+
+    delete network;
+    return 0;
+}